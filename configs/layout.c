@@ -0,0 +1,2918 @@
+#include <gst/gst.h>
+#include <gst/controller/controller.h>
+#include <gst/video/video.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "layout.h"
+
+#define LAYOUT_GROUP "layout"
+#define OUTPUT_GROUP "output"
+#define INPUT_GROUP_PREFIX "input "
+#define RENDITION_GROUP_PREFIX "rendition "
+
+/* Layout files */
+
+static gboolean read_int(GKeyFile *file, const gchar *group, const gchar *key, gint *value, GError **error) {
+  GError *local_error = NULL;
+  gint result;
+
+  if(!g_key_file_has_key(file, group, key, NULL)) {
+    return TRUE;
+  }
+
+  result = g_key_file_get_integer(file, group, key, &local_error);
+  if(local_error != NULL) {
+    g_propagate_error(error, local_error);
+    return FALSE;
+  }
+  *value = result;
+  return TRUE;
+}
+
+static gboolean read_double(GKeyFile *file, const gchar *group, const gchar *key, gdouble *value, GError **error) {
+  GError *local_error = NULL;
+  gdouble result;
+
+  if(!g_key_file_has_key(file, group, key, NULL)) {
+    return TRUE;
+  }
+
+  result = g_key_file_get_double(file, group, key, &local_error);
+  if(local_error != NULL) {
+    g_propagate_error(error, local_error);
+    return FALSE;
+  }
+  *value = result;
+  return TRUE;
+}
+
+static gboolean read_boolean(GKeyFile *file, const gchar *group, const gchar *key, gboolean *value, GError **error) {
+  GError *local_error = NULL;
+  gboolean result;
+
+  if(!g_key_file_has_key(file, group, key, NULL)) {
+    return TRUE;
+  }
+
+  result = g_key_file_get_boolean(file, group, key, &local_error);
+  if(local_error != NULL) {
+    g_propagate_error(error, local_error);
+    return FALSE;
+  }
+  *value = result;
+  return TRUE;
+}
+
+static gboolean read_choice(GKeyFile *file, const gchar *group, const gchar *key, const gchar * const *choices, gint *value, GError **error) {
+  gchar *text;
+  gint i;
+
+  text = g_key_file_get_string(file, group, key, NULL);
+  if(text == NULL) {
+    return TRUE;
+  }
+
+  for(i = 0; choices[i] != NULL; i++) {
+    if(g_ascii_strcasecmp(g_strstrip(text), choices[i]) == 0) {
+      *value = i;
+      g_free(text);
+      return TRUE;
+    }
+  }
+
+  g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+	      "Key '%s' in group '%s' has unknown value '%s'", key, group, text);
+  g_free(text);
+  return FALSE;
+}
+
+static const gchar * const leaky_choices[] = { "no", "upstream", "downstream", NULL };
+static const gchar * const quality_choices[] = { "full", "fast", "keyframes", NULL };
+static const gchar * const profile_choices[] = { "zero-latency", "balanced", "archive", NULL };
+/* Doubles as the element factory of each LayoutEncoder */
+static const gchar * const encoder_choices[] = { "x264enc", "vaapih264enc", NULL };
+
+static gboolean read_fraction(GKeyFile *file, const gchar *group, const gchar *key, gint *numerator, gint *denominator, GError **error) {
+  gchar *text;
+  gboolean ok = TRUE;
+
+  text = g_key_file_get_string(file, group, key, NULL);
+  if(text == NULL) {
+    return TRUE;
+  }
+
+  if(sscanf(text, "%d/%d", numerator, denominator) != 2 || *numerator <= 0 || *denominator <= 0) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		"Key '%s' in group '%s' is not a fraction like 25/1", key, group);
+    ok = FALSE;
+  }
+  g_free(text);
+  return ok;
+}
+
+static gboolean read_input(GKeyFile *file, const gchar *group, LayoutInput *input, GError **error) {
+  gboolean ok;
+
+  input->name = g_strdup(group + strlen(INPUT_GROUP_PREFIX));
+  input->alpha = 1.0;
+  input->location = g_key_file_get_string(file, group, "location", error);
+
+  if(input->location == NULL) {
+    return FALSE;
+  }
+
+  ok = read_int(file, group, "xpos", &input->xpos, error) &&
+    read_int(file, group, "ypos", &input->ypos, error) &&
+    read_int(file, group, "width", &input->width, error) &&
+    read_int(file, group, "height", &input->height, error) &&
+    read_int(file, group, "zorder", &input->zorder, error) &&
+    read_double(file, group, "alpha", &input->alpha, error) &&
+    read_int(file, group, "crop-left", &input->crop_left, error) &&
+    read_int(file, group, "crop-right", &input->crop_right, error) &&
+    read_int(file, group, "crop-top", &input->crop_top, error) &&
+    read_int(file, group, "crop-bottom", &input->crop_bottom, error) &&
+    read_int(file, group, "queue-time", &input->queue_time, error) &&
+    read_choice(file, group, "queue-leaky", leaky_choices, (gint *)&input->queue_leaky, error) &&
+    read_choice(file, group, "quality", quality_choices, (gint *)&input->quality, error) &&
+    read_int(file, group, "qp-offset", &input->qp_offset, error);
+
+  /* Crops only remove pixels, there is no border to add */
+  if(ok && (input->crop_left < 0 || input->crop_right < 0 || input->crop_top < 0 || input->crop_bottom < 0)) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		"Input '%s' has a negative crop", input->name);
+    ok = FALSE;
+  }
+  return ok;
+}
+
+static gboolean read_rendition(GKeyFile *file, const gchar *group, LayoutRendition *rendition, GError **error) {
+  rendition->name = g_strdup(group + strlen(RENDITION_GROUP_PREFIX));
+  rendition->locations = g_key_file_get_string_list(file, group, "location", NULL, error);
+
+  if(rendition->locations == NULL ||
+     !read_int(file, group, "width", &rendition->width, error) ||
+     !read_int(file, group, "height", &rendition->height, error) ||
+     !read_int(file, group, "bitrate", &rendition->bitrate, error)) {
+    return FALSE;
+  }
+
+  if(rendition->width <= 0 || rendition->height <= 0) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		"Rendition '%s' needs a width and a height", rendition->name);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Larger renditions first, so every rung can be scaled from the one before it */
+static gint compare_renditions(gconstpointer a, gconstpointer b) {
+  const LayoutRendition *first = a, *second = b;
+  gint64 first_area = (gint64)first->width * first->height;
+  gint64 second_area = (gint64)second->width * second->height;
+
+  return first_area < second_area ? 1 : first_area > second_area ? -1 : 0;
+}
+
+Layout *layout_load(const gchar *path, GError **error) {
+  GKeyFile *file;
+  Layout *layout;
+  gchar **groups;
+  gsize n_groups, i;
+  guint n_inputs = 0;
+  guint n_renditions = 1;
+  gboolean ok;
+
+  file = g_key_file_new();
+  if(!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, error)) {
+    g_key_file_free(file);
+    return NULL;
+  }
+
+  layout = g_new0(Layout, 1);
+  layout->name = g_key_file_get_string(file, LAYOUT_GROUP, "name", NULL);
+  if(layout->name == NULL) {
+    layout->name = g_path_get_basename(path);
+  }
+  layout->format = g_key_file_get_string(file, LAYOUT_GROUP, "format", NULL);
+  layout->output_queue_time = 2000;
+  layout->passthrough = TRUE;
+  layout->profile = LAYOUT_PROFILE_BALANCED;
+  layout->fast_start = TRUE;
+  layout->connect_timeout = 5;
+  layout->queue_time = 500;
+  layout->queue_leaky = LAYOUT_LEAKY_DOWNSTREAM;
+  layout->latency = 200;
+  layout->slate = g_key_file_get_string(file, LAYOUT_GROUP, "slate", NULL);
+
+  groups = g_key_file_get_groups(file, &n_groups);
+  layout->inputs = g_new0(LayoutInput, n_groups);
+  layout->renditions = g_new0(LayoutRendition, n_groups + 1);
+  layout->renditions[0].name = g_strdup(OUTPUT_GROUP);
+  layout->renditions[0].locations = g_key_file_get_string_list(file, OUTPUT_GROUP, "location", NULL, NULL);
+
+  ok = read_boolean(file, LAYOUT_GROUP, "passthrough", &layout->passthrough, error) &&
+    read_boolean(file, LAYOUT_GROUP, "fast-start", &layout->fast_start, error) &&
+    read_boolean(file, LAYOUT_GROUP, "switcher", &layout->switcher, error) &&
+    read_int(file, LAYOUT_GROUP, "connect-timeout", &layout->connect_timeout, error) &&
+    read_int(file, LAYOUT_GROUP, "max-inputs", (gint *)&layout->max_inputs, error) &&
+    read_int(file, OUTPUT_GROUP, "queue-time", &layout->output_queue_time, error) &&
+    read_int(file, OUTPUT_GROUP, "bitrate", &layout->renditions[0].bitrate, error) &&
+    read_choice(file, OUTPUT_GROUP, "profile", profile_choices, (gint *)&layout->profile, error) &&
+    read_choice(file, OUTPUT_GROUP, "encoder", encoder_choices, (gint *)&layout->encoder, error) &&
+    read_boolean(file, OUTPUT_GROUP, "adaptive", &layout->adaptive, error) &&
+    read_int(file, LAYOUT_GROUP, "queue-time", &layout->queue_time, error) &&
+    read_choice(file, LAYOUT_GROUP, "queue-leaky", leaky_choices, (gint *)&layout->queue_leaky, error) &&
+    read_int(file, LAYOUT_GROUP, "stats-interval", &layout->stats_interval, error) &&
+    read_boolean(file, LAYOUT_GROUP, "live", &layout->live, error) &&
+    read_int(file, LAYOUT_GROUP, "latency", &layout->latency, error) &&
+    read_int(file, LAYOUT_GROUP, "width", &layout->width, error) &&
+    read_int(file, LAYOUT_GROUP, "height", &layout->height, error) &&
+    read_fraction(file, LAYOUT_GROUP, "framerate", &layout->framerate_n, &layout->framerate_d, error);
+  if(ok && !g_key_file_has_key(file, LAYOUT_GROUP, "live", NULL)) {
+    layout->live = layout->width > 0 && layout->height > 0;
+  }
+  layout->renditions[0].width = layout->width;
+  layout->renditions[0].height = layout->height;
+
+
+  /* Inputs keep the order of the file, which is also the mixer pad order */
+  for(i = 0; ok && i < n_groups; i++) {
+    if(g_str_has_prefix(groups[i], INPUT_GROUP_PREFIX)) {
+      layout->inputs[n_inputs].queue_time = layout->queue_time;
+      layout->inputs[n_inputs].queue_leaky = layout->queue_leaky;
+      ok = read_input(file, groups[i], &layout->inputs[n_inputs], error);
+      n_inputs++;
+    }
+    else if(g_str_has_prefix(groups[i], RENDITION_GROUP_PREFIX)) {
+      ok = read_rendition(file, groups[i], &layout->renditions[n_renditions], error);
+      n_renditions++;
+    }
+  }
+  layout->n_inputs = n_inputs;
+  layout->n_renditions = n_renditions;
+  g_strfreev(groups);
+
+  /* Room for inputs added while running, see layout_add_input() */
+  if(ok && layout->max_inputs == 0) {
+    layout->max_inputs = MAX(n_inputs + 4, 16);
+  }
+  if(ok && layout->max_inputs < n_inputs) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		"Layout '%s' has more inputs than its max-inputs", path);
+    ok = FALSE;
+  }
+  if(ok && layout->max_inputs > n_groups) {
+    layout->inputs = g_renew(LayoutInput, layout->inputs, layout->max_inputs);
+    memset(&layout->inputs[n_groups], 0, (layout->max_inputs - n_groups) * sizeof(LayoutInput));
+  }
+
+  if(ok && n_renditions > 2) {
+    qsort(&layout->renditions[1], n_renditions - 1, sizeof(LayoutRendition), compare_renditions);
+  }
+  g_key_file_free(file);
+
+  if(ok && layout->n_inputs == 0) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+		"Layout '%s' has no [input ...] groups", path);
+    ok = FALSE;
+  }
+
+  /* Waiting for every input would let one that never connects hold up the show */
+  if(ok && !layout->live && !layout->switcher && layout->n_inputs > 1) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		"Layout '%s' composites several inputs, which needs live set and a width and height", path);
+    ok = FALSE;
+  }
+
+  /* A live composite needs a fixed canvas and rate to pace itself on */
+  if(ok && layout->live && (layout->width <= 0 || layout->height <= 0)) {
+    g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+		"Live layout '%s' needs a width and height", path);
+    ok = FALSE;
+  }
+  if(layout->live && layout->framerate_n == 0) {
+    layout->framerate_n = 25;
+    layout->framerate_d = 1;
+  }
+
+  if(!ok) {
+    layout_free(layout);
+    return NULL;
+  }
+  return layout;
+}
+
+void layout_free(Layout *layout) {
+  guint i;
+
+  if(layout == NULL) {
+    return;
+  }
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    g_free(layout->inputs[i].name);
+    g_free(layout->inputs[i].location);
+  }
+  g_free(layout->inputs);
+  for(i = 0; i < layout->n_renditions; i++) {
+    g_free(layout->renditions[i].name);
+    g_strfreev(layout->renditions[i].locations);
+  }
+  g_free(layout->renditions);
+  g_free(layout->name);
+  g_free(layout->format);
+  g_free(layout->slate);
+  g_free(layout);
+}
+
+/*
+ * A layout that shows one input untouched does not need the mixer or the
+ * encoder, its H.264 stream can be remuxed as it is.
+ */
+gboolean layout_can_remux(Layout *layout) {
+  LayoutInput *input = &layout->inputs[0];
+
+  if(!layout->passthrough || layout->switcher || layout->n_inputs != 1 || layout->n_renditions != 1) {
+    return FALSE;
+  }
+
+  if(layout->live || layout->width > 0 || layout->height > 0 || layout->format != NULL || layout->framerate_n > 0) {
+    return FALSE;
+  }
+
+  return input->xpos == 0 && input->ypos == 0 && input->width == 0 && input->height == 0 &&
+    input->alpha >= 1.0 && !input->crop_left && !input->crop_right && !input->crop_top && !input->crop_bottom;
+}
+
+/* Pipeline construction */
+
+static int build_failed(LayoutContext *context, const gchar *format, ...) {
+  va_list args;
+  gchar *message;
+  guint i;
+
+  va_start(args, format);
+  message = g_strdup_vprintf(format, args);
+  va_end(args);
+  g_printerr("%s\n", message);
+  g_free(message);
+
+  /* Inputs added to a running pipeline only leave their unlinked elements behind */
+  if(context->pipeline != NULL && !context->built) {
+    gst_object_unref(context->pipeline);
+    context->pipeline = NULL;
+    for(i = 0; context->branches != NULL && i < context->n_branches; i++) {
+      context->branches[i].bin = NULL;
+    }
+  }
+  return -1;
+}
+
+/* Creates an element and adds it to the pipeline, so a failed build only has to drop the pipeline */
+static GstElement *make_element_in(GstBin *bin, const gchar *factory, const gchar *prefix, const gchar *suffix) {
+  GstElement *element;
+  gchar *name;
+
+  name = prefix != NULL ? g_strdup_printf("%s_%s", prefix, suffix) : g_strdup(suffix);
+  element = gst_element_factory_make(factory, name);
+  if(element == NULL) {
+    g_printerr("Could not make the %s element '%s'.\n", factory, name);
+  }
+  else {
+    gst_bin_add(bin, element);
+  }
+  g_free(name);
+  return element;
+}
+
+static GstElement *make_element(LayoutContext *context, const gchar *factory, const gchar *prefix, const gchar *suffix) {
+  return make_element_in(GST_BIN(context->pipeline), factory, prefix, suffix);
+}
+
+/* Whether this GStreamer install has the element, for optional features */
+static gboolean has_element(const gchar *factory) {
+  GstElementFactory *element_factory = gst_element_factory_find(factory);
+
+  if(element_factory == NULL) {
+    return FALSE;
+  }
+  gst_object_unref(element_factory);
+  return TRUE;
+}
+
+static GstCaps *make_video_caps(gint width, gint height, const gchar *format, gint framerate_n, gint framerate_d) {
+  GstCaps *caps = gst_caps_new_empty_simple("video/x-raw");
+
+  if(width > 0) {
+    gst_caps_set_simple(caps, "width", G_TYPE_INT, width, NULL);
+  }
+  if(height > 0) {
+    gst_caps_set_simple(caps, "height", G_TYPE_INT, height, NULL);
+  }
+  if(format != NULL) {
+    gst_caps_set_simple(caps, "format", G_TYPE_STRING, format, NULL);
+  }
+  if(framerate_n > 0) {
+    gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, framerate_n, framerate_d, NULL);
+  }
+  return caps;
+}
+
+/* Tile telemetry, counted on both sides of the tile's queue */
+
+static GstPadProbeReturn count_queue_input_probe(GstPad *pad, GstPadProbeInfo *info, LayoutTile *tile) {
+  g_mutex_lock(&tile->stats_lock);
+  tile->buffers_in++;
+  g_mutex_unlock(&tile->stats_lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn count_queue_output_probe(GstPad *pad, GstPadProbeInfo *info, LayoutTile *tile) {
+  GstBuffer *buffer;
+  GstEvent *event;
+  GstClockTime running_time, now;
+
+  if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    event = GST_PAD_PROBE_INFO_EVENT(info);
+    if(GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT && gst_event_get_seqnum(event) != tile->segment_seqnum) {
+      g_mutex_lock(&tile->stats_lock);
+      gst_event_copy_segment(event, &tile->segment);
+      tile->segment_seqnum = gst_event_get_seqnum(event);
+      tile->align_pending = tile->align_to_clock;
+      g_mutex_unlock(&tile->stats_lock);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  now = gst_element_get_current_running_time(tile->queue);
+
+  g_mutex_lock(&tile->stats_lock);
+  tile->buffers_out++;
+  if(tile->segment.format == GST_FORMAT_TIME && GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)) && GST_CLOCK_TIME_IS_VALID(now)) {
+    running_time = gst_segment_to_running_time(&tile->segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    if(GST_CLOCK_TIME_IS_VALID(running_time)) {
+      /*
+       * RTMP streams are timestamped from their own start, not the pipeline
+       * clock, so the first frame of a segment is taken as captured now. The
+       * latency that follows is how far later frames fall behind that.
+       */
+      if(tile->align_pending) {
+	tile->offset = GST_CLOCK_DIFF(running_time, now);
+	gst_pad_set_offset(pad, tile->offset);
+	tile->align_pending = FALSE;
+      }
+      tile->latency = GST_CLOCK_DIFF(running_time + tile->offset, now);
+    }
+  }
+  g_mutex_unlock(&tile->stats_lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static void watch_tile_queue(LayoutTile *tile) {
+  GstPad *pad;
+
+  gst_segment_init(&tile->segment, GST_FORMAT_UNDEFINED);
+
+  pad = gst_element_get_static_pad(tile->queue, "sink");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)count_queue_input_probe, tile, NULL);
+  gst_object_unref(pad);
+
+  pad = gst_element_get_static_pad(tile->queue, "src");
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+		    (GstPadProbeCallback)count_queue_output_probe, tile, NULL);
+  gst_object_unref(pad);
+}
+
+/* Where a tile sits on the canvas, a width or height of 0 on the pad meaning the tile's own size */
+static void get_tile_rect(LayoutTile *tile, gint *xpos, gint *ypos, gint *width, gint *height) {
+  GstCaps *caps;
+  GstStructure *structure;
+
+  g_object_get(tile->mixer_pad, "xpos", xpos, "ypos", ypos, "width", width, "height", height, NULL);
+  if((*width == 0 || *height == 0) && (caps = gst_pad_get_current_caps(tile->mixer_pad)) != NULL) {
+    structure = gst_caps_get_structure(caps, 0);
+    if(*width == 0) {
+      gst_structure_get_int(structure, "width", width);
+    }
+    if(*height == 0) {
+      gst_structure_get_int(structure, "height", height);
+    }
+    gst_caps_unref(caps);
+  }
+}
+
+/*
+ * Holds a live composite back until the main input, the first one, shows
+ * up, so a show does not open on a slate only because a judge was quicker.
+ * Past connect-timeout seconds it goes on without it.
+ */
+static GstPadProbeReturn hold_output_probe(GstPad *pad, GstPadProbeInfo *info, LayoutContext *context) {
+  LayoutBranch *main_branch = context->tiles[0].branch;
+  gint64 waited = g_get_monotonic_time() - context->start_time;
+
+  if(main_branch != NULL && main_branch->first_frame_time == 0 &&
+     waited < (gint64)context->layout->connect_timeout * G_USEC_PER_SEC) {
+    return GST_PAD_PROBE_DROP;
+  }
+
+  if(main_branch != NULL && main_branch->first_frame_time == 0) {
+    g_print("Going live without '%s' after %" G_GINT64_FORMAT " ms.\n", main_branch->location, waited / 1000);
+  }
+  else {
+    g_print("Going live after %" G_GINT64_FORMAT " ms.\n", waited / 1000);
+  }
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/*
+ * Runs for every output frame. A tile that has not delivered a new frame
+ * since the previous one is blended again unchanged; the mixer has no way
+ * to keep that part of the last output, so those pixels are counted as
+ * work a damage tracking compositor would skip.
+ */
+static GstPadProbeReturn count_static_tiles_probe(GstPad *pad, GstPadProbeInfo *info, LayoutContext *context) {
+  LayoutTile *tile;
+  gint xpos, ypos, width, height;
+  gdouble alpha;
+  guint i;
+
+  for(i = 0; i < context->layout->n_inputs; i++) {
+    tile = &context->tiles[i];
+    /* The main loop releases the mixer pad of a tile it is removing */
+    if(tile->queue == NULL || tile->mixer_pad == NULL || tile->removing) {
+      continue;
+    }
+    /* A hidden or faded out tile is skipped by the mixer, not blended */
+    g_object_get(tile->mixer_pad, "alpha", &alpha, NULL);
+    if(alpha <= 0.0) {
+      continue;
+    }
+
+    if(tile->area == 0) {
+      get_tile_rect(tile, &xpos, &ypos, &width, &height);
+      tile->area = (guint64)width * height;
+    }
+
+    g_mutex_lock(&tile->stats_lock);
+    if(tile->buffers_out == tile->blended_buffers) {
+      tile->static_pixels += tile->area;
+    }
+    tile->blended_buffers = tile->buffers_out;
+    g_mutex_unlock(&tile->stats_lock);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/*
+ * Marks the tiles with a qp-offset on every output frame, with the
+ * GstVideoRegionOfInterestMeta vaapih264enc turns into a quantizer offset
+ * for the region. x264enc does not read it, layout_build() warns when the
+ * layout asks for it anyway.
+ */
+static GstPadProbeReturn add_roi_meta_probe(GstPad *pad, GstPadProbeInfo *info, LayoutContext *context) {
+  Layout *layout = context->layout;
+  GstVideoRegionOfInterestMeta *meta;
+  GstBuffer *buffer = NULL;
+  LayoutTile *tile;
+  gint xpos, ypos, width, height;
+  gdouble alpha;
+  guint i;
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    tile = &context->tiles[i];
+    if(layout->inputs[i].qp_offset == 0 || tile->queue == NULL || tile->mixer_pad == NULL || tile->removing) {
+      continue;
+    }
+    g_object_get(tile->mixer_pad, "alpha", &alpha, NULL);
+    if(alpha <= 0.0) {
+      continue;
+    }
+
+    get_tile_rect(tile, &xpos, &ypos, &width, &height);
+    /* Only the part of the tile that is on the canvas */
+    if(xpos < 0) {
+      width += xpos;
+      xpos = 0;
+    }
+    if(ypos < 0) {
+      height += ypos;
+      ypos = 0;
+    }
+    if(layout->width > 0) {
+      width = MIN(width, layout->width - xpos);
+    }
+    if(layout->height > 0) {
+      height = MIN(height, layout->height - ypos);
+    }
+    if(width <= 0 || height <= 0) {
+      continue;
+    }
+
+    if(buffer == NULL) {
+      buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+      GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    }
+    meta = gst_buffer_add_video_region_of_interest_meta(buffer, layout->inputs[i].name, xpos, ypos, width, height);
+    meta->id = i;
+    gst_video_region_of_interest_meta_add_param(meta, gst_structure_new("roi/vaapi", "delta-qp", G_TYPE_INT,
+									 layout->inputs[i].qp_offset, NULL));
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+gboolean layout_get_tile_stats(LayoutContext *context, guint index, LayoutTileStats *stats) {
+  LayoutTile *tile;
+  GstCaps *caps;
+  GstVideoInfo info;
+  guint64 queued;
+
+  if(context->tiles == NULL || index >= context->layout->n_inputs || context->tiles[index].queue == NULL) {
+    return FALSE;
+  }
+  tile = &context->tiles[index];
+
+  g_object_get(tile->queue, "current-level-buffers", &stats->level_buffers,
+	       "current-level-time", &stats->level_time, NULL);
+
+  g_mutex_lock(&tile->stats_lock);
+  stats->buffers_in = tile->buffers_in;
+  stats->buffers_out = tile->buffers_out;
+  stats->latency = tile->latency;
+  stats->static_pixels = tile->static_pixels;
+  g_mutex_unlock(&tile->stats_lock);
+
+  /*
+   * The separate scale pass would have written every tile-sized frame and
+   * the conversion read it back. The tile's negotiated frame size stands in
+   * for that intermediate frame.
+   */
+  stats->bytes_saved = 0;
+  if(tile->fused && (caps = gst_pad_get_current_caps(tile->mixer_pad)) != NULL) {
+    if(gst_video_info_from_caps(&info, caps)) {
+      stats->bytes_saved = stats->buffers_out * 2 * info.size;
+    }
+    gst_caps_unref(caps);
+  }
+
+  /* Whatever went in and neither came out nor is still queued was leaked */
+  queued = stats->buffers_out + stats->level_buffers;
+  stats->dropped = stats->buffers_in > queued ? stats->buffers_in - queued : 0;
+  return TRUE;
+}
+
+gboolean layout_print_tile_stats(LayoutContext *context) {
+  LayoutTileStats stats;
+  guint64 frames_in, frames_dropped;
+  gdouble seconds, static_rate, total_static_rate = 0.0;
+  gint64 now = g_get_monotonic_time();
+  guint i;
+
+  seconds = (now - (context->stats_time != 0 ? context->stats_time : context->start_time)) / 1e6;
+  context->stats_time = now;
+
+  for(i = 0; i < context->layout->n_inputs; i++) {
+    if(layout_get_tile_stats(context, i, &stats)) {
+      static_rate = seconds > 0 ? (stats.static_pixels - context->tiles[i].static_pixels_reported) / seconds : 0.0;
+      context->tiles[i].static_pixels_reported = stats.static_pixels;
+      total_static_rate += static_rate;
+      g_print("%-12s queue %3u buffers %5" G_GUINT64_FORMAT " ms, dropped %" G_GUINT64_FORMAT ", latency %" G_GINT64_FORMAT " ms",
+	      context->layout->inputs[i].name, stats.level_buffers, stats.level_time / GST_MSECOND,
+	      stats.dropped, stats.latency / (GstClockTimeDiff)GST_MSECOND);
+      if(context->tiles[i].fused) {
+	g_print(", fused scaling saved %" G_GUINT64_FORMAT " MiB", stats.bytes_saved >> 20);
+      }
+      g_print(", %.2f Mpixel/s blended unchanged\n", static_rate / 1e6);
+    }
+  }
+  g_print("Canvas: %.2f Mpixel/s blended unchanged\n", total_static_rate / 1e6);
+
+  for(i = 0; i < context->n_branches; i++) {
+    if(context->branches[i].rate != NULL) {
+      g_object_get(context->branches[i].rate, "in", &frames_in, "drop", &frames_dropped, NULL);
+      g_print("%s: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " decoded frames dropped before scaling\n",
+	      context->branches[i].location, frames_dropped, frames_in);
+    }
+    if(context->branches[i].reconnects > 0) {
+      g_print("%s: reconnected %u time(s), last after %" G_GINT64_FORMAT " ms\n", context->branches[i].location,
+	      context->branches[i].reconnects, context->branches[i].reconnect_time / 1000);
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Caps planning
+ *
+ * Decoded H.264 has no alpha and the mixer only applies per pad alpha, so
+ * one format can carry the frames from the decoder through the tiles and
+ * the mixer to the encoder. The plan takes the first format the decoder
+ * decodebin would pick can output that the mixer and encoder also accept,
+ * leaving every videoconvert in passthrough.
+ */
+
+/* Union of a factory's pad template caps in one direction */
+static GstCaps *factory_template_caps(GstElementFactory *factory, GstPadDirection direction) {
+  const GList *templates;
+  GstStaticPadTemplate *template;
+  GstCaps *caps = gst_caps_new_empty();
+
+  for(templates = gst_element_factory_get_static_pad_templates(factory); templates != NULL; templates = templates->next) {
+    template = templates->data;
+    if(template->direction == direction) {
+      caps = gst_caps_merge(caps, gst_static_pad_template_get_caps(template));
+    }
+  }
+  return caps;
+}
+
+/* The highest ranked H.264 decoder, the one decodebin will plug */
+static GstElementFactory *find_h264_decoder(void) {
+  GList *decoders, *h264_decoders;
+  GstElementFactory *decoder = NULL;
+  GstCaps *caps = gst_caps_new_empty_simple("video/x-h264");
+
+  decoders = gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DECODER | GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO,
+						   GST_RANK_MARGINAL);
+  h264_decoders = gst_element_factory_list_filter(decoders, caps, GST_PAD_SINK, FALSE);
+  h264_decoders = g_list_sort(h264_decoders, gst_plugin_feature_rank_compare_func);
+  if(h264_decoders != NULL) {
+    decoder = gst_object_ref(h264_decoders->data);
+  }
+  gst_plugin_feature_list_free(h264_decoders);
+  gst_plugin_feature_list_free(decoders);
+  gst_caps_unref(caps);
+  return decoder;
+}
+
+static gboolean accepts_format(GstCaps *caps, const gchar *format) {
+  GstCaps *format_caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, format, NULL);
+  gboolean accepted = gst_caps_can_intersect(caps, format_caps);
+
+  gst_caps_unref(format_caps);
+  return accepted;
+}
+
+/* First format of the decoder's own preference order the others accept too */
+static const gchar *pick_format(GstCaps *decoder_caps, GstCaps *mixer_caps, GstCaps *encoder_caps) {
+  const GValue *formats, *format;
+  guint i, j, n_formats;
+
+  for(i = 0; i < gst_caps_get_size(decoder_caps); i++) {
+    formats = gst_structure_get_value(gst_caps_get_structure(decoder_caps, i), "format");
+    if(formats == NULL) {
+      continue;
+    }
+    n_formats = GST_VALUE_HOLDS_LIST(formats) ? gst_value_list_get_size(formats) : 1;
+    for(j = 0; j < n_formats; j++) {
+      format = GST_VALUE_HOLDS_LIST(formats) ? gst_value_list_get_value(formats, j) : formats;
+      if(G_VALUE_HOLDS_STRING(format) && accepts_format(mixer_caps, g_value_get_string(format)) &&
+	 accepts_format(encoder_caps, g_value_get_string(format))) {
+	return g_value_get_string(format);
+      }
+    }
+  }
+  return NULL;
+}
+
+static void plan_format(LayoutContext *context, Layout *layout) {
+  GstElementFactory *decoder, *encoder;
+  GstCaps *decoder_caps = NULL, *mixer_caps, *encoder_caps = NULL;
+  const gchar *format = NULL;
+
+  if(layout->format != NULL) {
+    context->format = g_strdup(layout->format);
+    g_print("Layout '%s' works in %s, as set by its format key.\n", layout->name, context->format);
+    return;
+  }
+
+  decoder = find_h264_decoder();
+  encoder = gst_element_factory_find(encoder_choices[layout->encoder]);
+  mixer_caps = factory_template_caps(gst_element_get_factory(context->mixer), GST_PAD_SINK);
+  if(decoder != NULL && encoder != NULL) {
+    decoder_caps = factory_template_caps(decoder, GST_PAD_SRC);
+    encoder_caps = factory_template_caps(encoder, GST_PAD_SINK);
+    format = pick_format(decoder_caps, mixer_caps, encoder_caps);
+  }
+
+  /* Without a common format, I420 at least needs no conversion before either encoder */
+  context->format = g_strdup(format != NULL ? format : "I420");
+  g_print("Layout '%s' works in %s: %s decodes to it, %s blends it and %s encodes it, %s.\n",
+	  layout->name, context->format, decoder != NULL ? GST_OBJECT_NAME(decoder) : "no H.264 decoder",
+	  GST_ELEMENT_NAME(gst_element_get_factory(context->mixer)), encoder_choices[layout->encoder],
+	  format != NULL ? "no conversion needed" : "the tiles convert once");
+
+  if(decoder_caps != NULL) {
+    gst_caps_unref(decoder_caps);
+  }
+  if(encoder_caps != NULL) {
+    gst_caps_unref(encoder_caps);
+  }
+  gst_caps_unref(mixer_caps);
+  if(decoder != NULL) {
+    gst_object_unref(decoder);
+  }
+  if(encoder != NULL) {
+    gst_object_unref(encoder);
+  }
+}
+
+/*
+ * queue ! [videocrop !] [videoscale !] videoconvert ! capsfilter ! mixer
+ *
+ * The bounded queue keeps a late input from holding up its decoder, or the
+ * other inputs sharing its branch. The crop and scale stages are only built
+ * when the tile asks for them, or in a live layout, which a switch can give
+ * a new crop and size while it plays. Where videoconvertscale exists it replaces
+ * videoscale ! videoconvert, scaling and converting in one pass over the
+ * frame instead of writing a scaled copy and reading it back.
+ *
+ * videocrop leaves the decoded frame alone and attaches a crop meta when the
+ * next element can read it, so the cropped region is only copied by the
+ * scale or conversion pass that reads it anyway. videobox copied every frame.
+ */
+static int build_tile(LayoutContext *context, LayoutInput *input, LayoutTile *tile, GstPadTemplate *mixer_sink_pad_template) {
+  GstElement **chain = tile->elements;
+  GstCaps *caps;
+  GstPad *tile_pad;
+  GstPadLinkReturn link_return;
+  gboolean crops = input->crop_left || input->crop_right || input->crop_top || input->crop_bottom;
+  gboolean scales = input->width > 0 || input->height > 0 || context->layout->live;
+  guint n_chain = 0, n_threads, i;
+
+  /* Row slices of each frame are converted in parallel, sharing the cores between tiles */
+  n_threads = MAX(1, g_get_num_processors() / context->layout->n_inputs);
+
+  tile->queue = make_element(context, "queue", input->name, "queue");
+  chain[n_chain++] = tile->queue;
+  if(tile->queue != NULL) {
+    g_object_set(tile->queue, "leaky", input->queue_leaky, "max-size-buffers", 0, "max-size-bytes", 0,
+		 "max-size-time", (guint64)input->queue_time * GST_MSECOND, NULL);
+  }
+  if(crops || scales) {
+    tile->cropper = make_element(context, "videocrop", input->name, "cropper");
+    chain[n_chain] = tile->cropper;
+    if(chain[n_chain] != NULL) {
+      g_object_set(chain[n_chain], "left", input->crop_left, "right", input->crop_right,
+		   "top", input->crop_top, "bottom", input->crop_bottom, NULL);
+    }
+    n_chain++;
+  }
+  tile->fused = scales && has_element("videoconvertscale");
+  if(tile->fused) {
+    chain[n_chain] = make_element(context, "videoconvertscale", input->name, "converter");
+  }
+  else {
+    if(scales) {
+      chain[n_chain] = make_element(context, "videoscale", input->name, "scaler");
+      if(chain[n_chain] != NULL) {
+	g_object_set(chain[n_chain], "n-threads", n_threads, NULL);
+      }
+      n_chain++;
+    }
+    chain[n_chain] = make_element(context, "videoconvert", input->name, "converter");
+  }
+  if(chain[n_chain] != NULL) {
+    g_object_set(chain[n_chain], "n-threads", n_threads, NULL);
+  }
+  n_chain++;
+  chain[n_chain++] = make_element(context, "capsfilter", input->name, "caps");
+
+  for(i = 0; i < n_chain; i++) {
+    if(chain[i] == NULL) {
+      return build_failed(context, "Could not build the '%s' tile.", input->name);
+    }
+  }
+
+  caps = make_video_caps(input->width, input->height, context->format, 0, 0);
+  g_object_set(chain[n_chain - 1], "caps", caps, NULL);
+  gst_caps_unref(caps);
+
+  for(i = 1; i < n_chain; i++) {
+    if(!gst_element_link(chain[i - 1], chain[i])) {
+      return build_failed(context, "Could not link '%s' to '%s'.", GST_ELEMENT_NAME(chain[i - 1]), GST_ELEMENT_NAME(chain[i]));
+    }
+  }
+  tile->sink = chain[0];
+  tile->n_elements = n_chain;
+  watch_tile_queue(tile);
+
+  tile->mixer_pad = gst_element_request_pad(context->mixer, mixer_sink_pad_template, NULL, NULL);
+  if(tile->mixer_pad == NULL) {
+    return build_failed(context, "Could not request a mixer pad for the '%s' input.", input->name);
+  }
+
+  tile_pad = gst_element_get_static_pad(chain[n_chain - 1], "src");
+  link_return = gst_pad_link(tile_pad, tile->mixer_pad);
+  gst_object_unref(tile_pad);
+  if(GST_PAD_LINK_FAILED(link_return)) {
+    return build_failed(context, "Could not link the '%s' input to the mixer.", input->name);
+  }
+
+  /* In live mode the slate takes zorder 0 */
+  g_object_set(tile->mixer_pad, "xpos", input->xpos, "ypos", input->ypos,
+	       "zorder", input->zorder + (context->layout->live ? 1 : 0), "alpha", input->alpha, NULL);
+  tile->align_to_clock = context->layout->live;
+
+  /*
+   * Decoded video carries no alpha of its own, so an opaque tile replaces
+   * whatever is under it: the source operator copies its rows instead of
+   * blending every pixel. Only translucent tiles are blended over the tiles
+   * they overlap.
+   */
+  tile->opaque = input->alpha >= 1.0 &&
+    g_object_class_find_property(G_OBJECT_GET_CLASS(tile->mixer_pad), "operator") != NULL;
+  if(tile->opaque) {
+    gst_util_set_object_arg(G_OBJECT(tile->mixer_pad), "operator", "source");
+  }
+  return 0;
+}
+
+/* Only keyframes reach the decoder of a keyframes quality branch */
+static GstPadProbeReturn drop_delta_units_probe(GstPad *pad, GstPadProbeInfo *info, LayoutBranch *branch) {
+  if(GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT)) {
+    return GST_PAD_PROBE_DROP;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/*
+ * Cheapens the decoder decodebin plugs for a reduced quality branch. fast
+ * has libav skip B-frames, which nothing else references; streams encoded
+ * with bframes=0, as all of ours are, have none and decode at full cost.
+ * keyframes decodes one frame per GOP and repeats it, which saves on any
+ * stream.
+ */
+static void reduce_decoder_cost(GstBin *bin, GstElement *element, LayoutBranch *branch) {
+  GstElementFactory *factory = gst_element_get_factory(element);
+  GObjectClass *element_class = G_OBJECT_GET_CLASS(element);
+  GstPad *pad;
+
+  if(factory == NULL || !gst_element_factory_list_is_type(factory, GST_ELEMENT_FACTORY_TYPE_DECODER)) {
+    return;
+  }
+
+  if(branch->quality == LAYOUT_QUALITY_KEYFRAMES) {
+    pad = gst_element_get_static_pad(element, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)drop_delta_units_probe, branch, NULL);
+    gst_object_unref(pad);
+    g_print("'%s' decodes with %s at keyframes quality.\n", branch->location, GST_ELEMENT_NAME(element));
+  }
+  else if(g_object_class_find_property(element_class, "skip-frame") != NULL) {
+    g_object_set(element, "skip-frame", 1, NULL);
+    g_print("'%s' decodes with %s skipping B-frames, a stream without them costs as much as at full quality.\n",
+	    branch->location, GST_ELEMENT_NAME(element));
+  }
+  else {
+    g_printerr("'%s' decodes with %s, which has no cheaper mode: fast quality saves nothing, keyframes would.\n",
+	       branch->location, GST_ELEMENT_NAME(element));
+  }
+}
+
+static gboolean lose_input(LayoutBranch *branch);
+
+/*
+ * Hides a tile while its input is down. A layout switch may be animating
+ * its alpha, so that control binding is paused meanwhile.
+ */
+static void show_tile(LayoutContext *context, guint index, gboolean visible) {
+  GstPad *mixer_pad = context->tiles[index].mixer_pad;
+
+  gst_object_set_control_binding_disabled(GST_OBJECT(mixer_pad), "alpha", !visible);
+  g_object_set(mixer_pad, "alpha", visible ? context->layout->inputs[index].alpha : 0.0, NULL);
+}
+
+/*
+ * An input that ended or dropped its connection is restarted rather than
+ * letting its EOS reach the mixer. The first buffer after a restart shows
+ * its tiles again.
+ */
+static GstPadProbeReturn watch_input_probe(GstPad *pad, GstPadProbeInfo *info, LayoutBranch *branch) {
+  LayoutContext *context = branch->context;
+  guint i;
+
+  if(info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    if(GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS) {
+      g_idle_add((GSourceFunc)lose_input, branch);
+      return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_atomic_int_set(&branch->waiting, FALSE);
+  if(branch->first_frame_time == 0) {
+    branch->first_frame_time = g_get_monotonic_time() - context->start_time;
+    g_print("'%s' delivered its first frame after %" G_GINT64_FORMAT " ms, %" G_GINT64_FORMAT " ms of it connecting (%s).\n",
+	    branch->location, branch->first_frame_time / 1000, branch->connect_time / 1000,
+	    branch->fast_start ? "fast start" : "decodebin");
+  }
+
+  if(g_atomic_int_compare_and_exchange(&branch->down, TRUE, FALSE)) {
+    branch->reconnect_time = g_get_monotonic_time() - branch->down_since;
+    branch->reconnects++;
+    for(i = 0; i < context->layout->n_inputs; i++) {
+      if(context->tiles[i].branch == branch) {
+	show_tile(context, i, TRUE);
+      }
+    }
+    g_print("'%s' is back after %" G_GINT64_FORMAT " ms.\n", branch->location, branch->reconnect_time / 1000);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static void watch_decodebin(LayoutBranch *branch, GstElement *decodebin) {
+  g_signal_connect(decodebin, "pad-added", G_CALLBACK(layout_pad_added_handler), branch);
+  if(branch->quality != LAYOUT_QUALITY_FULL) {
+    g_signal_connect(decodebin, "element-added", G_CALLBACK(reduce_decoder_cost), branch);
+  }
+}
+
+/*
+ * flvdemux ~> h264parse ! decoder, all but the demuxer pad known up front.
+ * This skips decodebin's typefinding and autoplugging, which hold up the
+ * first frame of every input, and the decoder is the one decodebin would
+ * have picked anyway.
+ */
+static int build_fast_start_decoder(LayoutContext *context, LayoutBranch *branch, const gchar *name) {
+  GstElementFactory *decoder_factory;
+  GstElement *decoder = NULL;
+  GstPad *decoder_pad;
+  gchar *decoder_name;
+
+  branch->parser = make_element_in(GST_BIN(branch->bin), "h264parse", name, "parser");
+  decoder_factory = find_h264_decoder();
+  if(decoder_factory != NULL) {
+    decoder_name = g_strdup_printf("%s_decoder", name);
+    decoder = gst_element_factory_create(decoder_factory, decoder_name);
+    g_free(decoder_name);
+    gst_object_unref(decoder_factory);
+  }
+  if(branch->parser == NULL || decoder == NULL) {
+    return build_failed(context, "Could not build the H.264 decoder for '%s'.", branch->location);
+  }
+  gst_bin_add(GST_BIN(branch->bin), decoder);
+
+  if(!gst_element_link(branch->parser, decoder)) {
+    return build_failed(context, "Could not link the '%s' parser to its decoder.", name);
+  }
+  if(branch->quality != LAYOUT_QUALITY_FULL) {
+    reduce_decoder_cost(GST_BIN(branch->bin), decoder, branch);
+  }
+
+  decoder_pad = gst_element_get_static_pad(decoder, "src");
+  gst_ghost_pad_set_target(GST_GHOST_PAD(branch->ghost_pad), decoder_pad);
+  gst_object_unref(decoder_pad);
+  return 0;
+}
+
+/*
+ * H.264 from flvdemux goes to the parser. Anything else is handed to a
+ * decodebin, which takes over the input's ghost pad.
+ */
+static void link_demuxed_video(GstElement *demuxer, GstPad *pad, LayoutBranch *branch) {
+  GstPad *sink_pad;
+  GstCaps *caps = gst_pad_query_caps(pad, NULL);
+  const gchar *type = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+
+  if(!g_str_has_prefix(type, "video/")) {
+    gst_caps_unref(caps);
+    return;
+  }
+
+  if(strcmp(type, "video/x-h264") == 0 && branch->fallback == NULL) {
+    sink_pad = gst_element_get_static_pad(branch->parser, "sink");
+  }
+  else {
+    if(branch->fallback == NULL) {
+      g_print("'%s' is %s, not H.264, falling back to decodebin.\n", branch->location, type);
+      branch->fast_start = FALSE;
+      gst_ghost_pad_set_target(GST_GHOST_PAD(branch->ghost_pad), NULL);
+      branch->fallback = gst_element_factory_make("decodebin", NULL);
+      gst_bin_add(GST_BIN(branch->bin), branch->fallback);
+      watch_decodebin(branch, branch->fallback);
+      gst_element_sync_state_with_parent(branch->fallback);
+    }
+    sink_pad = gst_element_get_static_pad(branch->fallback, "sink");
+  }
+
+  if(!gst_pad_is_linked(sink_pad) && GST_PAD_LINK_FAILED(gst_pad_link(pad, sink_pad))) {
+    g_print("Could not link the '%s' demuxer pad of type '%s'.\n", branch->location, type);
+  }
+  gst_object_unref(sink_pad);
+  gst_caps_unref(caps);
+}
+
+/*
+ * rtmpsrc ! decodebin in their own bin ~> [videorate !] tile, or
+ * ~> [videorate !] tee with one tile chain per pad when several tiles show
+ * this location
+ */
+static int build_branch(LayoutContext *context, Layout *layout, LayoutBranch *branch) {
+  GstElement *source;
+  const gchar *name = NULL;
+  guint i;
+
+  /* Elements are named after the first tile showing the location */
+  for(i = 0; i < layout->n_inputs && name == NULL; i++) {
+    if(context->tiles[i].branch == branch) {
+      name = layout->inputs[i].name;
+    }
+  }
+
+  /* The source and decoder sit in their own bin so they can be restarted alone */
+  branch->context = context;
+  branch->bin = make_element(context, "bin", name, "input");
+  if(branch->bin == NULL) {
+    return build_failed(context, "Could not build the input bin for '%s'.", branch->location);
+  }
+  source = make_element_in(GST_BIN(branch->bin), "rtmpsrc", name, "source");
+  branch->fast_start = layout->fast_start;
+  branch->source = make_element_in(GST_BIN(branch->bin), branch->fast_start ? "flvdemux" : "decodebin", name,
+				   branch->fast_start ? "demuxer" : "decoder");
+  branch->media_type = "video/x-raw";
+  branch->format = context->format;
+  branch->backoff = LAYOUT_RECONNECT_MIN_BACKOFF;
+  if(!source || !branch->source) {
+    return build_failed(context, "Could not build the source for '%s'.", branch->location);
+  }
+
+  g_object_set(source, "location", branch->location, NULL);
+  if(g_object_class_find_property(G_OBJECT_GET_CLASS(source), "timeout") != NULL) {
+    g_object_set(source, "timeout", layout->connect_timeout, NULL);
+  }
+  gst_element_set_locked_state(branch->bin, TRUE);
+  if(!gst_element_link(source, branch->source)) {
+    return build_failed(context, "Could not link the '%s' RTMP source to its %s.", name,
+			branch->fast_start ? "demuxer" : "decoder bin");
+  }
+
+  branch->ghost_pad = gst_ghost_pad_new_no_target("src", GST_PAD_SRC);
+  gst_element_add_pad(branch->bin, branch->ghost_pad);
+  if(branch->fast_start && build_fast_start_decoder(context, branch, name) != 0) {
+    return -1;
+  }
+  gst_pad_add_probe(branch->ghost_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+		    (GstPadProbeCallback)watch_input_probe, branch, NULL);
+
+  /* Live layouts keep one for inputs added later on the same location */
+  if(branch->n_tiles > 1 || layout->live) {
+    branch->tee = make_element(context, "tee", name, "tee");
+    branch->sink = branch->tee;
+    if(branch->sink == NULL) {
+      return build_failed(context, "Could not build the tee for '%s'.", branch->location);
+    }
+  }
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    if(context->tiles[i].branch != branch) {
+      continue;
+    }
+    if(branch->tee == NULL) {
+      branch->sink = context->tiles[i].sink;
+    }
+    else if(!gst_element_link(branch->sink, context->tiles[i].sink)) {
+      return build_failed(context, "Could not link the '%s' tee to the '%s' tile.", name, layout->inputs[i].name);
+    }
+  }
+
+  /*
+   * Frames the output rate has no room for are dropped straight after
+   * decoding, before any tile scales, converts or blends them
+   */
+  if(layout->framerate_n > 0) {
+    branch->rate = make_element(context, "videorate", name, "rate");
+    if(branch->rate == NULL) {
+      return build_failed(context, "Could not build the rate stage for '%s'.", branch->location);
+    }
+    g_object_set(branch->rate, "drop-only", TRUE,
+		 "max-rate", (layout->framerate_n + layout->framerate_d - 1) / layout->framerate_d, NULL);
+    if(!gst_element_link(branch->rate, branch->sink)) {
+      return build_failed(context, "Could not link the '%s' rate stage.", name);
+    }
+    branch->sink = branch->rate;
+  }
+
+  if(!gst_element_link(branch->bin, branch->sink)) {
+    return build_failed(context, "Could not link the '%s' input bin.", name);
+  }
+
+  /* decodebin links to the branch sink once its video pad shows up */
+  if(branch->fast_start) {
+    g_signal_connect(branch->source, "pad-added", G_CALLBACK(link_demuxed_video), branch);
+  }
+  else {
+    watch_decodebin(branch, branch->source);
+  }
+  return 0;
+}
+
+/*
+ * videotestsrc is-live=true ! capsfilter ! mixer
+ *
+ * The slate fills the canvas under every tile. Being live, it also drives
+ * the compositor's output clock: frames go out on time even while no RTMP
+ * input is delivering.
+ */
+static int build_slate(LayoutContext *context, Layout *layout, GstPadTemplate *mixer_sink_pad_template) {
+  GstElement *source, *capsfilter;
+  GParamSpec *spec;
+  GValue pattern = G_VALUE_INIT;
+  GstCaps *caps;
+  GstPad *slate_pad, *mixer_pad;
+  GstPadLinkReturn link_return;
+
+  source = make_element(context, "videotestsrc", NULL, "slate");
+  capsfilter = make_element(context, "capsfilter", NULL, "slate_caps");
+  if(!source || !capsfilter) {
+    return build_failed(context, "Could not build the slate.");
+  }
+
+  g_object_set(source, "is-live", TRUE, NULL);
+
+  /* gst_util_set_object_arg() only logs a pattern it cannot parse, so it is parsed here */
+  spec = g_object_class_find_property(G_OBJECT_GET_CLASS(source), "pattern");
+  g_value_init(&pattern, spec->value_type);
+  if(!gst_value_deserialize(&pattern, layout->slate != NULL ? layout->slate : "black")) {
+    g_value_unset(&pattern);
+    return build_failed(context, "Unknown slate pattern '%s'.", layout->slate);
+  }
+  g_object_set_property(G_OBJECT(source), "pattern", &pattern);
+  g_value_unset(&pattern);
+  caps = make_video_caps(layout->width, layout->height, context->format, layout->framerate_n, layout->framerate_d);
+  g_object_set(capsfilter, "caps", caps, NULL);
+  gst_caps_unref(caps);
+
+  if(!gst_element_link(source, capsfilter)) {
+    return build_failed(context, "Could not link the slate to its caps filter.");
+  }
+
+  mixer_pad = gst_element_request_pad(context->mixer, mixer_sink_pad_template, NULL, NULL);
+  if(mixer_pad == NULL) {
+    return build_failed(context, "Could not request a mixer pad for the slate.");
+  }
+  g_object_set(mixer_pad, "zorder", 0, NULL);
+
+  slate_pad = gst_element_get_static_pad(capsfilter, "src");
+  link_return = gst_pad_link(slate_pad, mixer_pad);
+  gst_object_unref(slate_pad);
+  gst_object_unref(mixer_pad);
+  if(GST_PAD_LINK_FAILED(link_return)) {
+    return build_failed(context, "Could not link the slate to the mixer.");
+  }
+  return 0;
+}
+
+/* Tiles with the same location share one branch */
+static void assign_branches(LayoutContext *context, Layout *layout) {
+  LayoutBranch *branch;
+  guint i, j;
+
+  context->branches = g_new0(LayoutBranch, layout->max_inputs);
+  context->tiles = g_new0(LayoutTile, layout->max_inputs);
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    branch = NULL;
+    for(j = 0; j < context->n_branches && branch == NULL; j++) {
+      if(g_strcmp0(context->branches[j].location, layout->inputs[i].location) == 0) {
+	branch = &context->branches[j];
+      }
+    }
+    if(branch == NULL) {
+      branch = &context->branches[context->n_branches++];
+      branch->location = g_strdup(layout->inputs[i].location);
+      branch->quality = layout->inputs[i].quality;
+    }
+    /* A shared decode serves the most demanding of its tiles */
+    branch->quality = MIN(branch->quality, layout->inputs[i].quality);
+    branch->n_tiles++;
+    context->tiles[i].branch = branch;
+    g_mutex_init(&context->tiles[i].stats_lock);
+  }
+
+  g_print("Layout '%s' opens %u location(s) for %u tile(s).\n", layout->name, context->n_branches, layout->n_inputs);
+}
+
+/*
+ * Buffers for a destination whose sink has failed are dropped at the tee.
+ * Once a frame has been dropped the following ones cannot be decoded
+ * either, so dropping goes on until the next keyframe:
+ * - a destination whose queue holds queue-time drops from that frame on,
+ *   keyframes included until one finds room again;
+ * - a congested destination only gets keyframes until the congestion has
+ *   cleared.
+ * The queue's own leak, past twice queue-time, is left for a sink that has
+ * stopped altogether.
+ */
+static GstPadProbeReturn filter_destination_probe(GstPad *pad, GstPadProbeInfo *info, LayoutDestination *destination) {
+  GstBuffer *buffer;
+  guint64 level_time;
+  gboolean full;
+
+  if(g_atomic_int_get(&destination->failed)) {
+    return GST_PAD_PROBE_DROP;
+  }
+  if(!(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  if(GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_HEADER)) {
+    return GST_PAD_PROBE_OK;
+  }
+  g_object_get(destination->queue, "current-level-time", &level_time, NULL);
+  full = destination->max_time > 0 && level_time >= destination->max_time;
+  if(!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) && !full) {
+    destination->dropping = g_atomic_int_get(&destination->congested);
+    return GST_PAD_PROBE_OK;
+  }
+  if(destination->dropping || full || g_atomic_int_get(&destination->congested)) {
+    destination->dropping = TRUE;
+    destination->frames_dropped++;
+    return GST_PAD_PROBE_DROP;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/*
+ * identity ! fakesink in a bin, taking BYTES per second like a slow uplink
+ * would. identity restamps the buffers from the byte count and waits for
+ * the clock, so the queue in front of it fills up just as it would in
+ * front of a congested rtmpsink.
+ */
+static GstElement *make_throttled_sink(LayoutContext *context, const gchar *prefix, const gchar *suffix, gint rate) {
+  GstElement *bin, *identity, *sink;
+  GstPad *pad;
+  gchar *name;
+
+  name = g_strdup_printf("%s_%s", prefix, suffix);
+  bin = gst_bin_new(name);
+  g_free(name);
+  identity = make_element_in(GST_BIN(bin), "identity", prefix, "throttle");
+  sink = make_element_in(GST_BIN(bin), "fakesink", prefix, "throttled_sink");
+  if(!identity || !sink || !gst_element_link(identity, sink)) {
+    gst_object_unref(bin);
+    return NULL;
+  }
+  g_object_set(identity, "datarate", rate, "sync", TRUE, NULL);
+  g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+
+  pad = gst_element_get_static_pad(identity, "sink");
+  gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+  gst_object_unref(pad);
+  gst_bin_add(GST_BIN(context->pipeline), bin);
+  return bin;
+}
+
+/*
+ * flvmux ! tee ! queue ! rtmpsink, one leaky queue and sink per location
+ *
+ * A destination that falls behind only loses data from its own queue, and
+ * one that fails is dropped by layout_cb_message without touching the rest.
+ */
+static int build_destinations(LayoutContext *context, Layout *layout, LayoutRendition *rendition, GstElement *muxer,
+			      GstElement *encoder) {
+  LayoutDestination *destination;
+  GstElement *tee;
+  GstPad *queue_pad;
+  GstPadLinkReturn link_return;
+  gchar *suffix;
+  guint i, bitrate = 0;
+
+  if(encoder != NULL) {
+    g_object_get(encoder, "bitrate", &bitrate, NULL);
+  }
+
+  tee = make_element(context, "tee", rendition->name, "tee");
+  if(tee == NULL) {
+    return build_failed(context, "Could not build the '%s' output tee.", rendition->name);
+  }
+  g_object_set(tee, "allow-not-linked", TRUE, NULL);
+
+  if(!gst_element_link(muxer, tee)) {
+    return build_failed(context, "Could not link the '%s' FLV muxer to its tee.", rendition->name);
+  }
+
+  for(i = 0; rendition->locations[i] != NULL; i++) {
+    destination = &context->destinations[context->n_destinations++];
+    context->n_active_destinations++;
+    destination->context = context;
+    destination->tee = tee;
+    destination->location = g_strstrip(g_strdup(rendition->locations[i]));
+    destination->encoder = encoder;
+    destination->max_bitrate = bitrate;
+
+    suffix = g_strdup_printf("queue_%u", i);
+    destination->queue = make_element(context, "queue", rendition->name, suffix);
+    g_free(suffix);
+    suffix = g_strdup_printf("sink_%u", i);
+    if(g_str_has_prefix(destination->location, "throttle:")) {
+      destination->sink = make_throttled_sink(context, rendition->name, suffix, atoi(destination->location + strlen("throttle:")));
+    }
+    else if(g_str_has_prefix(destination->location, "file:")) {
+      destination->sink = make_element(context, "filesink", rendition->name, suffix);
+      if(destination->sink != NULL) {
+	g_object_set(destination->sink, "location", destination->location + strlen("file:"), NULL);
+      }
+    }
+    else {
+      destination->sink = make_element(context, "rtmpsink", rendition->name, suffix);
+      if(destination->sink != NULL) {
+	g_object_set(destination->sink, "location", destination->location, NULL);
+      }
+    }
+    g_free(suffix);
+
+    if(!destination->queue || !destination->sink) {
+      return build_failed(context, "Could not build the output to '%s'.", destination->location);
+    }
+
+    /*
+     * Bounded by time only, filter_destination_probe() keeping it within
+     * queue-time. Should the sink stall outright, the oldest data goes
+     * rather than the tee blocking every other destination.
+     */
+    destination->max_time = (GstClockTime)layout->output_queue_time * GST_MSECOND;
+    g_object_set(destination->queue, "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0,
+		 "max-size-time", 2 * destination->max_time, NULL);
+
+    if(!gst_element_link(destination->queue, destination->sink)) {
+      return build_failed(context, "Could not link the output queue to the sink for '%s'.", destination->location);
+    }
+
+    destination->tee_pad = gst_element_request_pad_simple(tee, "src_%u");
+    queue_pad = gst_element_get_static_pad(destination->queue, "sink");
+    link_return = gst_pad_link(destination->tee_pad, queue_pad);
+    gst_object_unref(queue_pad);
+    if(GST_PAD_LINK_FAILED(link_return)) {
+      return build_failed(context, "Could not link the output tee to the queue for '%s'.", destination->location);
+    }
+
+    gst_pad_add_probe(destination->tee_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+		      (GstPadProbeCallback)filter_destination_probe, destination, NULL);
+  }
+  return 0;
+}
+
+/*
+ * Encoder settings per LayoutProfile. Lookahead and frame threads each hold
+ * frames back, zero-latency gives them up for sliced threads and a small
+ * VBV buffer; archive spends them on quality. vaapih264enc only takes the
+ * keyframe interval and its own quality level, 1 the best and 7 the fastest.
+ */
+static const struct {
+  const gchar *tune;
+  const gchar *speed_preset;
+  gboolean sliced_threads;
+  gint rc_lookahead;
+  gint sync_lookahead;
+  /* Seconds between keyframes, milliseconds of VBV buffer */
+  gint keyframe_interval;
+  guint vbv_buf_capacity;
+  guint quality_level;
+} encoder_profiles[] = {
+  { "zerolatency", "superfast", TRUE, 0, 0, 1, 250, 7 },
+  { NULL, "veryfast", FALSE, 10, 0, 2, 1000, 4 },
+  { NULL, "medium", FALSE, 40, -1, 4, 2000, 1 }
+};
+
+/* vaapih264enc's properties vary with its version, unknown ones are skipped */
+static void set_encoder_property(GstElement *encoder, const gchar *property, guint value) {
+  if(g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), property) != NULL) {
+    g_object_set(encoder, property, value, NULL);
+  }
+}
+
+static void set_encoder_profile(GstElement *encoder, Layout *layout) {
+  gint framerate = layout->framerate_n > 0 ? (layout->framerate_n + layout->framerate_d - 1) / layout->framerate_d : 25;
+
+  if(layout->encoder == LAYOUT_ENCODER_VAAPI) {
+    set_encoder_property(encoder, "max-bframes", 0);
+    set_encoder_property(encoder, "keyframe-period", encoder_profiles[layout->profile].keyframe_interval * framerate);
+    set_encoder_property(encoder, "quality-level", encoder_profiles[layout->profile].quality_level);
+    return;
+  }
+
+  g_object_set(encoder, "bframes", 0, NULL);
+  if(encoder_profiles[layout->profile].tune != NULL) {
+    gst_util_set_object_arg(G_OBJECT(encoder), "tune", encoder_profiles[layout->profile].tune);
+  }
+  gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", encoder_profiles[layout->profile].speed_preset);
+  g_object_set(encoder, "threads", 0,
+	       "sliced-threads", encoder_profiles[layout->profile].sliced_threads,
+	       "rc-lookahead", encoder_profiles[layout->profile].rc_lookahead,
+	       "sync-lookahead", encoder_profiles[layout->profile].sync_lookahead,
+	       "key-int-max", (guint)(encoder_profiles[layout->profile].keyframe_interval * framerate),
+	       "vbv-buf-capacity", encoder_profiles[layout->profile].vbv_buf_capacity, NULL);
+}
+
+/*
+ * [queue !] videoconvert ! x264enc|vaapih264enc ! flvmux ! tee
+ *
+ * The queue gives the encoder its own streaming thread when several
+ * renditions are encoded side by side.
+ */
+static int build_encoder(LayoutContext *context, Layout *layout, LayoutRendition *rendition, GstElement *upstream, gboolean threaded) {
+  GstElement *queue = NULL, *converter, *encoder, *muxer;
+
+  if(threaded) {
+    queue = make_element(context, "queue", rendition->name, "encoder_queue");
+  }
+  converter = make_element(context, "videoconvert", rendition->name, "converter");
+  encoder = make_element(context, encoder_choices[layout->encoder], rendition->name, "encoder");
+  muxer = make_element(context, "flvmux", rendition->name, "muxer");
+
+  if((threaded && !queue) || !converter || !encoder || !muxer) {
+    return build_failed(context, "Could not build the '%s' encoder.", rendition->name);
+  }
+
+  set_encoder_profile(encoder, layout);
+  if(rendition->bitrate > 0) {
+    /* vaapih264enc defaults to constant quality, which ignores the bitrate */
+    if(layout->encoder == LAYOUT_ENCODER_VAAPI) {
+      gst_util_set_object_arg(G_OBJECT(encoder), "rate-control", "cbr");
+    }
+    g_object_set(encoder, "bitrate", rendition->bitrate, NULL);
+  }
+  g_object_set(muxer, "streamable", TRUE, NULL);
+
+  if(queue != NULL && !gst_element_link(upstream, queue)) {
+    return build_failed(context, "Could not link the '%s' encoder queue.", rendition->name);
+  }
+
+  if(!gst_element_link_many(queue != NULL ? queue : upstream, converter, encoder, muxer, NULL)) {
+    return build_failed(context, "Could not link the '%s' encoder.", rendition->name);
+  }
+  return build_destinations(context, layout, rendition, muxer, encoder);
+}
+
+/*
+ * mixer ! capsfilter ! [tee !] encoder for the [output] rendition, then for
+ * each smaller rendition
+ *
+ *   previous tee ! queue ! videoscale ! capsfilter ! [tee !] encoder
+ *
+ * The composite is built once and every rung is scaled from the rung above,
+ * which is cheaper than scaling each one from the full canvas.
+ */
+static int build_output(LayoutContext *context, Layout *layout) {
+  LayoutRendition *rendition;
+  GstElement *raw, *queue, *scaler, *capsfilter, *tee;
+  GstCaps *caps;
+  gboolean threaded = layout->n_renditions > 1;
+  guint i;
+
+  raw = make_element(context, "capsfilter", NULL, "output_caps");
+  if(raw == NULL) {
+    return build_failed(context, "Could not build the output stage.");
+  }
+
+  caps = make_video_caps(layout->width, layout->height, context->format, layout->framerate_n, layout->framerate_d);
+  g_object_set(raw, "caps", caps, NULL);
+  gst_caps_unref(caps);
+
+  if(!gst_element_link(context->mixer, raw)) {
+    return build_failed(context, "Could not link the mixer to the output stage.");
+  }
+
+  for(i = 0; i < layout->n_renditions; i++) {
+    rendition = &layout->renditions[i];
+
+    if(i > 0) {
+      queue = make_element(context, "queue", rendition->name, "scaler_queue");
+      scaler = make_element(context, "videoscale", rendition->name, "scaler");
+      capsfilter = make_element(context, "capsfilter", rendition->name, "caps");
+      if(!queue || !scaler || !capsfilter) {
+	return build_failed(context, "Could not build the '%s' scaler.", rendition->name);
+      }
+
+      caps = make_video_caps(rendition->width, rendition->height, NULL, 0, 0);
+      g_object_set(capsfilter, "caps", caps, NULL);
+      gst_caps_unref(caps);
+
+      if(!gst_element_link_many(raw, queue, scaler, capsfilter, NULL)) {
+	return build_failed(context, "Could not link the '%s' scaler.", rendition->name);
+      }
+      raw = capsfilter;
+    }
+
+    /* Every rung but the smallest also feeds the scaler of the next one */
+    if(i + 1 < layout->n_renditions) {
+      tee = make_element(context, "tee", rendition->name, "raw_tee");
+      if(tee == NULL || !gst_element_link(raw, tee)) {
+	return build_failed(context, "Could not build the '%s' raw tee.", rendition->name);
+      }
+      raw = tee;
+    }
+
+    if(build_encoder(context, layout, rendition, raw, threaded) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* rtmpsrc ! flvdemux ~> h264parse ! flvmux ! tee, nothing gets decoded or encoded */
+static int build_remux(LayoutContext *context, Layout *layout) {
+  LayoutInput *input = &layout->inputs[0];
+  LayoutBranch *branch;
+  GstElement *source, *muxer;
+
+  assign_branches(context, layout);
+  branch = &context->branches[0];
+
+  source = make_element(context, "rtmpsrc", input->name, "source");
+  branch->source = make_element(context, "flvdemux", input->name, "demuxer");
+  branch->sink = make_element(context, "h264parse", input->name, "parser");
+  branch->media_type = "video/x-h264";
+  muxer = make_element(context, "flvmux", NULL, "muxer");
+
+  if(!source || !branch->source || !branch->sink || !muxer) {
+    return build_failed(context, "Could not build the remuxing pipeline.");
+  }
+
+  g_object_set(source, "location", input->location, NULL);
+  g_object_set(muxer, "streamable", TRUE, NULL);
+
+  if(!gst_element_link(source, branch->source)) {
+    return build_failed(context, "Could not link the '%s' RTMP source to its demuxer.", input->name);
+  }
+
+  if(!gst_element_link(branch->sink, muxer)) {
+    return build_failed(context, "Could not link the H.264 parser to the FLV muxer.");
+  }
+
+  g_signal_connect(branch->source, "pad-added", G_CALLBACK(layout_pad_added_handler), branch);
+  return build_destinations(context, layout, &layout->renditions[0], muxer, NULL);
+}
+
+/*
+ * Runs for every buffer an input offers the selector. A cut waits for the
+ * target's next keyframe, the first frame it can be joined at without a
+ * decoder, and switches the selector right before that frame goes in.
+ */
+static GstPadProbeReturn cut_on_keyframe_probe(GstPad *pad, GstPadProbeInfo *info, LayoutBranch *branch) {
+  LayoutContext *context = branch->context;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+  if(GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) || GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_HEADER)) {
+    return GST_PAD_PROBE_OK;
+  }
+  if(g_atomic_pointer_compare_and_exchange(&context->cut_branch, branch, NULL)) {
+    g_object_set(context->selector, "active-pad", pad, NULL);
+    g_print("Cut to '%s' %" G_GINT64_FORMAT " ms after it was asked for.\n", branch->location,
+	    (g_get_monotonic_time() - context->cut_time) / 1000);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/*
+ * rtmpsrc ! flvdemux ~> h264parse ! input-selector, per location, then
+ * input-selector ! flvmux ! tee
+ *
+ * Only the active input reaches the muxer, the others are dropped at the
+ * selector, so an input costs its network and parsing only. h264parse
+ * repeats SPS and PPS before each keyframe so a player can pick up the new
+ * input's parameters right at the cut.
+ */
+static int build_switcher(LayoutContext *context, Layout *layout) {
+  LayoutBranch *branch;
+  GstElement *source, *muxer;
+  GstPad *parser_pad;
+  GstPadLinkReturn link_return;
+  const gchar *name;
+  guint i, j;
+
+  assign_branches(context, layout);
+  context->selector = make_element(context, "input-selector", NULL, "selector");
+  muxer = make_element(context, "flvmux", NULL, "muxer");
+  if(!context->selector || !muxer) {
+    return build_failed(context, "Could not build the switcher.");
+  }
+
+  /* Inactive inputs are dropped straight away rather than held back in step with the active one */
+  g_object_set(context->selector, "sync-streams", FALSE, NULL);
+  g_object_set(muxer, "streamable", TRUE, NULL);
+  if(!gst_element_link(context->selector, muxer)) {
+    return build_failed(context, "Could not link the switcher to the FLV muxer.");
+  }
+
+  for(i = 0; i < context->n_branches; i++) {
+    branch = &context->branches[i];
+    branch->context = context;
+    branch->media_type = "video/x-h264";
+    /* Named after the first input showing the location */
+    for(j = 0; context->tiles[j].branch != branch; j++);
+    name = layout->inputs[j].name;
+
+    source = make_element(context, "rtmpsrc", name, "source");
+    branch->source = make_element(context, "flvdemux", name, "demuxer");
+    branch->sink = make_element(context, "h264parse", name, "parser");
+    if(!source || !branch->source || !branch->sink) {
+      return build_failed(context, "Could not build the switcher input '%s'.", branch->location);
+    }
+
+    g_object_set(source, "location", branch->location, NULL);
+    g_object_set(branch->sink, "config-interval", -1, NULL);
+    if(!gst_element_link(source, branch->source)) {
+      return build_failed(context, "Could not link the '%s' RTMP source to its demuxer.", branch->location);
+    }
+
+    branch->selector_pad = gst_element_request_pad_simple(context->selector, "sink_%u");
+    parser_pad = gst_element_get_static_pad(branch->sink, "src");
+    link_return = gst_pad_link(parser_pad, branch->selector_pad);
+    gst_object_unref(parser_pad);
+    if(GST_PAD_LINK_FAILED(link_return)) {
+      return build_failed(context, "Could not link the '%s' parser to the switcher.", branch->location);
+    }
+
+    gst_pad_add_probe(branch->selector_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)cut_on_keyframe_probe, branch, NULL);
+    g_signal_connect(branch->source, "pad-added", G_CALLBACK(layout_pad_added_handler), branch);
+  }
+
+  g_object_set(context->selector, "active-pad", context->branches[0].selector_pad, NULL);
+  g_print("Layout '%s' switches between %u input(s), showing '%s'.\n", layout->name, context->n_branches,
+	  context->branches[0].location);
+  return build_destinations(context, layout, &layout->renditions[0], muxer, NULL);
+}
+
+int layout_build(LayoutContext *context, Layout *layout) {
+  GstPadTemplate *mixer_sink_pad_template;
+  GstPad *mixer_pad;
+  GstBus *bus;
+  guint i, n_locations = 0, n_opaque;
+
+  if(layout->renditions[0].locations == NULL || layout->renditions[0].locations[0] == NULL) {
+    g_printerr("Layout '%s' has no output location.\n", layout->name);
+    return -1;
+  }
+
+  for(i = 0; i < layout->n_renditions; i++) {
+    n_locations += g_strv_length(layout->renditions[i].locations);
+  }
+  context->destinations = g_new0(LayoutDestination, n_locations);
+
+  context->layout = layout;
+  context->pipeline = gst_pipeline_new(layout->name);
+  if(context->pipeline == NULL) {
+    return build_failed(context, "Could not create the '%s' pipeline.", layout->name);
+  }
+
+  bus = gst_element_get_bus(context->pipeline);
+  gst_bus_set_sync_handler(bus, (GstBusSyncHandler)layout_bus_sync_handler, context, NULL);
+  gst_object_unref(bus);
+
+  if(layout->switcher) {
+    context->remuxing = TRUE;
+    return build_switcher(context, layout);
+  }
+
+  if(layout_can_remux(layout)) {
+    g_print("Layout '%s' only relays '%s', remuxing without decoding.\n", layout->name, layout->inputs[0].name);
+    context->remuxing = TRUE;
+    return build_remux(context, layout);
+  }
+
+  if(layout->encoder == LAYOUT_ENCODER_VAAPI && !has_element("vaapih264enc")) {
+    g_printerr("Layout '%s' asks for vaapih264enc, which is not installed, encoding with x264enc.\n", layout->name);
+    layout->encoder = LAYOUT_ENCODER_X264;
+  }
+  for(i = 0; i < layout->n_inputs && layout->encoder == LAYOUT_ENCODER_X264; i++) {
+    if(layout->inputs[i].qp_offset != 0) {
+      g_printerr("Layout '%s' gives its tiles qp-offsets, which x264enc ignores; set encoder=vaapih264enc under [output].\n",
+		 layout->name);
+      break;
+    }
+  }
+
+  /*
+   * compositor copies opaque tiles and skips the background wherever tiles
+   * cover it, and in a live pipeline stops waiting for a pad after its
+   * latency. Tile sizes, switching and the statistics rely on its pads'
+   * width and height, which videomixer's lack, so there is no fallback.
+   */
+  context->mixer = make_element(context, "compositor", NULL, "mixer");
+  if(context->mixer == NULL) {
+    return build_failed(context, "Could not build the mixer, compositor from gst-plugins-base is needed.");
+  }
+  if(layout->live) {
+    g_object_set(context->mixer, "latency", (guint64)layout->latency * GST_MSECOND, NULL);
+  }
+  mixer_pad = gst_element_get_static_pad(context->mixer, "src");
+  if(layout->live) {
+    gst_pad_add_probe(mixer_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)hold_output_probe, context, NULL);
+  }
+  gst_pad_add_probe(mixer_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)count_static_tiles_probe, context, NULL);
+  gst_pad_add_probe(mixer_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)add_roi_meta_probe, context, NULL);
+  gst_object_unref(mixer_pad);
+
+  plan_format(context, layout);
+  if(build_output(context, layout) != 0) {
+    return -1;
+  }
+
+  mixer_sink_pad_template = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(context->mixer), "sink_%u");
+  if(mixer_sink_pad_template == NULL) {
+    return build_failed(context, "Could not get mixer pad template.");
+  }
+
+  if(layout->live && build_slate(context, layout, mixer_sink_pad_template) != 0) {
+    return -1;
+  }
+
+  assign_branches(context, layout);
+  for(i = 0; i < layout->n_inputs; i++) {
+    if(build_tile(context, &layout->inputs[i], &context->tiles[i], mixer_sink_pad_template) != 0) {
+      return -1;
+    }
+  }
+
+  for(i = 0, n_opaque = 0; i < layout->n_inputs; i++) {
+    n_opaque += context->tiles[i].opaque ? 1 : 0;
+  }
+  g_print("Layout '%s' copies %u of %u tiles without blending.\n", layout->name, n_opaque, layout->n_inputs);
+
+  for(i = 0; i < context->n_branches; i++) {
+    if(build_branch(context, layout, &context->branches[i]) != 0) {
+      return -1;
+    }
+  }
+
+  GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(context->pipeline), GST_DEBUG_GRAPH_SHOW_MEDIA_TYPE, "afterelementlink");
+  context->built = TRUE;
+  return 0;
+}
+
+static void stop_connecting(LayoutBranch *branch);
+
+void layout_context_clear(LayoutContext *context) {
+  guint i;
+
+  /*
+   * Streaming threads and probes use the tiles and branches freed below. A
+   * failed build has already dropped the pipeline, and the bins with it.
+   */
+  for(i = 0; context->pipeline != NULL && context->branches != NULL && i < context->n_branches; i++) {
+    if(context->branches[i].bin != NULL) {
+      gst_element_set_state(context->branches[i].bin, GST_STATE_NULL);
+    }
+  }
+  if(context->pipeline != NULL) {
+    gst_element_set_state(context->pipeline, GST_STATE_NULL);
+  }
+
+  if(context->destinations != NULL) {
+    for(i = 0; i < context->n_destinations; i++) {
+      if(context->destinations[i].tee_pad != NULL) {
+	gst_object_unref(context->destinations[i].tee_pad);
+      }
+      g_free(context->destinations[i].location);
+    }
+    g_free(context->destinations);
+    context->destinations = NULL;
+  }
+
+  if(context->tiles != NULL) {
+    for(i = 0; i < context->layout->n_inputs; i++) {
+      if(context->tiles[i].mixer_pad != NULL) {
+	gst_object_unref(context->tiles[i].mixer_pad);
+      }
+      if(context->tiles[i].tee_pad != NULL) {
+	gst_object_unref(context->tiles[i].tee_pad);
+      }
+      if(context->tiles[i].removal_source != 0) {
+	g_source_remove(context->tiles[i].removal_source);
+      }
+      g_mutex_clear(&context->tiles[i].stats_lock);
+    }
+    g_free(context->tiles);
+    context->tiles = NULL;
+  }
+  if(context->branches != NULL) {
+    for(i = 0; i < context->n_branches; i++) {
+      if(context->branches[i].reconnect_source != 0) {
+	g_source_remove(context->branches[i].reconnect_source);
+      }
+      stop_connecting(&context->branches[i]);
+      if(context->branches[i].cancellable != NULL) {
+	g_object_unref(context->branches[i].cancellable);
+      }
+      if(context->branches[i].selector_pad != NULL) {
+	gst_object_unref(context->branches[i].selector_pad);
+      }
+      g_free(context->branches[i].location);
+    }
+  }
+  g_free(context->branches);
+  context->branches = NULL;
+  g_free(context->format);
+  context->format = NULL;
+  context->n_branches = 0;
+
+  if(context->pipeline != NULL) {
+    gst_object_unref(context->pipeline);
+    context->pipeline = NULL;
+  }
+  context->mixer = NULL;
+  context->selector = NULL;
+}
+
+void layout_print_cpu_usage(LayoutContext *context) {
+  struct rusage usage;
+  gdouble cpu_seconds, wall_seconds;
+
+  if(context->start_time == 0 || getrusage(RUSAGE_SELF, &usage) != 0) {
+    return;
+  }
+
+  cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  wall_seconds = (g_get_monotonic_time() - context->start_time) / 1e6;
+  if(wall_seconds <= 0) {
+    return;
+  }
+
+  g_print("CPU: %.2fs over %.2fs, %.1f%% of one core, %.1f%% per input (%s)\n",
+	  cpu_seconds, wall_seconds, 100.0 * cpu_seconds / wall_seconds,
+	  100.0 * cpu_seconds / wall_seconds / context->layout->n_inputs,
+	  context->remuxing ? "remuxed" : "transcoded");
+}
+
+/* Shared callbacks */
+
+static LayoutDestination *find_destination(LayoutContext *context, GstObject *object) {
+  guint i;
+
+  for(i = 0; i < context->n_destinations; i++) {
+    if(object == GST_OBJECT(context->destinations[i].sink) || object == GST_OBJECT(context->destinations[i].queue)) {
+      return &context->destinations[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Runs in the thread that posted the message. Marking the destination failed
+ * right away keeps the tee from seeing its error flow return, which would
+ * otherwise stop the encoder and every other destination.
+ */
+GstBusSyncReply layout_bus_sync_handler(GstBus *bus, GstMessage *msg, LayoutContext *context) {
+  LayoutDestination *destination;
+
+  if(GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+    destination = find_destination(context, GST_MESSAGE_SRC(msg));
+    if(destination != NULL) {
+      g_atomic_int_set(&destination->failed, TRUE);
+    }
+  }
+  return GST_BUS_PASS;
+}
+
+static gboolean remove_destination_elements(LayoutDestination *destination) {
+  gst_element_set_state(destination->sink, GST_STATE_NULL);
+  gst_element_set_state(destination->queue, GST_STATE_NULL);
+  gst_bin_remove(GST_BIN(destination->context->pipeline), destination->queue);
+  gst_bin_remove(GST_BIN(destination->context->pipeline), destination->sink);
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn release_destination_probe(GstPad *pad, GstPadProbeInfo *info, LayoutDestination *destination) {
+  GstPad *queue_pad = gst_element_get_static_pad(destination->queue, "sink");
+
+  gst_pad_unlink(destination->tee_pad, queue_pad);
+  gst_object_unref(queue_pad);
+  gst_element_release_request_pad(destination->tee, destination->tee_pad);
+  /* Elements cannot be shut down from the streaming thread that may be running this probe */
+  g_idle_add((GSourceFunc)remove_destination_elements, destination);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void remove_destination(LayoutDestination *destination) {
+  LayoutContext *context = destination->context;
+
+  if(destination->removed) {
+    return;
+  }
+  destination->removed = TRUE;
+  context->n_active_destinations--;
+  g_print("Dropping output '%s', %u output(s) left.\n", destination->location, context->n_active_destinations);
+  gst_pad_add_probe(destination->tee_pad, GST_PAD_PROBE_TYPE_IDLE,
+		    (GstPadProbeCallback)release_destination_probe, destination, NULL);
+}
+
+/* Output bitrate adaptation, on the main loop */
+
+/* How full a destination's queue is, in percent of queue-time, which it only goes past when its sink stalls */
+static guint destination_fill(LayoutDestination *destination) {
+  guint64 level_time;
+
+  g_object_get(destination->queue, "current-level-time", &level_time, NULL);
+  return destination->max_time > 0 ? (guint)(100 * level_time / destination->max_time) : 0;
+}
+
+/*
+ * Runs every LAYOUT_ADAPT_INTERVAL milliseconds. Whatever waits in a
+ * destination queue is how far the uplink lags behind the encoder, so the
+ * fullest queue of each rendition sets its bitrate: cut by a quarter when
+ * above LAYOUT_ADAPT_HIGH_FILL, raised by a twentieth of the configured
+ * bitrate when below LAYOUT_ADAPT_LOW_FILL. A destination above
+ * LAYOUT_ADAPT_CONGESTED_FILL is left with keyframes only until it drains.
+ */
+gboolean layout_adapt_bitrate(LayoutContext *context) {
+  LayoutDestination *destination;
+  guint i, j, fill, max_fill, bitrate, new_bitrate;
+
+  for(i = 0; i < context->n_destinations; i = j) {
+    max_fill = 0;
+    for(j = i; j < context->n_destinations && context->destinations[j].encoder == context->destinations[i].encoder; j++) {
+      destination = &context->destinations[j];
+      if(destination->removed || g_atomic_int_get(&destination->failed)) {
+	continue;
+      }
+
+      fill = destination_fill(destination);
+      max_fill = MAX(max_fill, fill);
+      if(fill > LAYOUT_ADAPT_CONGESTED_FILL && !g_atomic_int_get(&destination->congested)) {
+	g_print("Output '%s' congested, queue %u%% full, sending keyframes only.\n", destination->location, fill);
+	g_atomic_int_set(&destination->congested, TRUE);
+      }
+      else if(fill < LAYOUT_ADAPT_LOW_FILL && g_atomic_int_get(&destination->congested)) {
+	g_print("Output '%s' caught up after dropping %" G_GUINT64_FORMAT " frames.\n", destination->location,
+		destination->frames_dropped);
+	g_atomic_int_set(&destination->congested, FALSE);
+      }
+    }
+
+    destination = &context->destinations[i];
+    if(destination->encoder == NULL || destination->max_bitrate == 0) {
+      continue;
+    }
+
+    g_object_get(destination->encoder, "bitrate", &bitrate, NULL);
+    new_bitrate = bitrate;
+    if(max_fill > LAYOUT_ADAPT_HIGH_FILL) {
+      new_bitrate = MAX(bitrate * 3 / 4, destination->max_bitrate / 8);
+    }
+    else if(max_fill < LAYOUT_ADAPT_LOW_FILL) {
+      new_bitrate = MIN(bitrate + MAX(destination->max_bitrate / 20, 1), destination->max_bitrate);
+    }
+    if(new_bitrate != bitrate) {
+      /* x264enc reconfigures its rate control in place, no keyframe is forced */
+      g_object_set(destination->encoder, "bitrate", new_bitrate, NULL);
+      g_print("%s: output queues up to %u%% full, bitrate %u -> %u kbit/s\n",
+	      GST_OBJECT_NAME(destination->encoder), max_fill, bitrate, new_bitrate);
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Input reconnection, on the main loop */
+
+static LayoutBranch *find_branch(LayoutContext *context, GstObject *object) {
+  guint i;
+
+  for(i = 0; i < context->n_branches; i++) {
+    if(context->branches[i].bin != NULL && gst_object_has_as_ancestor(object, GST_OBJECT(context->branches[i].bin))) {
+      return &context->branches[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * rtmpsrc connects while going to PAUSED, blocking whoever changes its
+ * state. Each input bin is therefore locked out of the pipeline's state
+ * changes and started from a thread of its own, so inputs connect in
+ * parallel and neither the pipeline nor the main loop waits on one.
+ */
+static gpointer connect_input_thread(LayoutBranch *branch) {
+  GSocketClient *client;
+  GSocketConnection *connection;
+  GError *error = NULL;
+  gchar *uri;
+  gint64 start = g_get_monotonic_time();
+
+  /*
+   * rtmpsrc's timeout only covers reads once connected, connect() to a host
+   * that drops the packets would take minutes to fail. The server is tried
+   * first with a bounded, cancellable connect, librtmp options after the URL
+   * left out.
+   */
+  uri = g_strndup(branch->location, strcspn(branch->location, " "));
+  client = g_socket_client_new();
+  g_socket_client_set_timeout(client, branch->context->layout->connect_timeout);
+  connection = g_socket_client_connect_to_uri(client, uri, 1935, branch->cancellable, &error);
+  g_object_unref(client);
+  g_free(uri);
+
+  if(connection == NULL) {
+    g_print("Could not reach '%s': %s\n", branch->location, error->message);
+    g_error_free(error);
+    g_atomic_int_set(&branch->connecting, FALSE);
+    g_idle_add((GSourceFunc)lose_input, branch);
+    return NULL;
+  }
+  g_object_unref(connection);
+
+  if(gst_element_sync_state_with_parent(branch->bin)) {
+    branch->connect_time = g_get_monotonic_time() - start;
+    g_print("'%s' connected in %" G_GINT64_FORMAT " ms.\n", branch->location, branch->connect_time / 1000);
+  }
+  g_atomic_int_set(&branch->connecting, FALSE);
+  return NULL;
+}
+
+/*
+ * connect-timeout seconds into an attempt that has not delivered a frame.
+ * One still in connect() is cancelled and hands over to lose_input() itself;
+ * once in librtmp it cannot be, but rtmpsrc's own timeout bounds that, so
+ * the deadline looks again a second later.
+ */
+static gboolean connect_deadline(LayoutBranch *branch) {
+  if(!g_atomic_int_get(&branch->waiting)) {
+    branch->deadline_source = 0;
+    return G_SOURCE_REMOVE;
+  }
+  if(g_atomic_int_get(&branch->connecting)) {
+    g_cancellable_cancel(branch->cancellable);
+    branch->deadline_source = g_timeout_add_seconds(1, (GSourceFunc)connect_deadline, branch);
+    return G_SOURCE_REMOVE;
+  }
+
+  g_print("'%s' delivered nothing within %d s.\n", branch->location, branch->context->layout->connect_timeout);
+  branch->deadline_source = 0;
+  lose_input(branch);
+  return G_SOURCE_REMOVE;
+}
+
+static void connect_input(LayoutBranch *branch) {
+  if(branch->connect_thread != NULL) {
+    g_thread_join(branch->connect_thread);
+  }
+  if(branch->cancellable == NULL) {
+    branch->cancellable = g_cancellable_new();
+  }
+  g_cancellable_reset(branch->cancellable);
+  if(branch->deadline_source != 0) {
+    g_source_remove(branch->deadline_source);
+  }
+
+  g_atomic_int_set(&branch->waiting, TRUE);
+  g_atomic_int_set(&branch->connecting, TRUE);
+  branch->deadline_source = g_timeout_add_seconds(MAX(branch->context->layout->connect_timeout, 1),
+						  (GSourceFunc)connect_deadline, branch);
+  branch->connect_thread = g_thread_new(GST_ELEMENT_NAME(branch->bin), (GThreadFunc)connect_input_thread, branch);
+}
+
+/* Ends the input's current attempt, waiting for a thread still connecting */
+static void stop_connecting(LayoutBranch *branch) {
+  if(branch->deadline_source != 0) {
+    g_source_remove(branch->deadline_source);
+    branch->deadline_source = 0;
+  }
+  if(branch->cancellable != NULL) {
+    g_cancellable_cancel(branch->cancellable);
+  }
+  if(branch->connect_thread != NULL) {
+    g_thread_join(branch->connect_thread);
+    branch->connect_thread = NULL;
+  }
+}
+
+void layout_connect_inputs(LayoutContext *context) {
+  guint i;
+
+  for(i = 0; i < context->n_branches; i++) {
+    if(context->branches[i].bin != NULL) {
+      connect_input(&context->branches[i]);
+    }
+  }
+}
+
+static gboolean restart_input(LayoutBranch *branch) {
+  branch->reconnect_source = 0;
+  g_print("Reconnecting to '%s'.\n", branch->location);
+  connect_input(branch);
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Stops the input's bin and tries it again after a delay that doubles with
+ * every attempt that fails before delivering a frame. Its tiles are see
+ * through meanwhile, showing the slate in live mode.
+ */
+static gboolean lose_input(LayoutBranch *branch) {
+  LayoutContext *context = branch->context;
+  guint i;
+
+  if(branch->reconnect_source != 0 || branch->removing || branch->bin == NULL) {
+    return G_SOURCE_REMOVE;
+  }
+  if(branch->deadline_source != 0) {
+    g_source_remove(branch->deadline_source);
+    branch->deadline_source = 0;
+  }
+
+  if(g_atomic_int_get(&branch->down)) {
+    branch->backoff = MIN(branch->backoff * 2, LAYOUT_RECONNECT_MAX_BACKOFF);
+  }
+  else {
+    branch->backoff = LAYOUT_RECONNECT_MIN_BACKOFF;
+    branch->down_since = g_get_monotonic_time();
+    g_atomic_int_set(&branch->down, TRUE);
+    for(i = 0; i < context->layout->n_inputs; i++) {
+      if(context->tiles[i].branch == branch) {
+	show_tile(context, i, FALSE);
+      }
+    }
+  }
+
+  gst_element_set_state(branch->bin, GST_STATE_NULL);
+  g_print("Lost '%s', reconnecting in %u ms.\n", branch->location, branch->backoff);
+  branch->reconnect_source = g_timeout_add(branch->backoff, (GSourceFunc)restart_input, branch);
+  return G_SOURCE_REMOVE;
+}
+
+/* Inputs added and removed while playing */
+
+/* Inputs on their way out no longer count, their name can be taken again */
+static gint find_input(LayoutContext *context, const gchar *name) {
+  guint i;
+
+  for(i = 0; i < context->layout->n_inputs; i++) {
+    if(context->tiles[i].queue != NULL && !context->tiles[i].removing &&
+       strcmp(context->layout->inputs[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* The slot of a removed input, or the next one never used, -1 when full */
+static gint find_free_tile(LayoutContext *context) {
+  Layout *layout = context->layout;
+  guint i;
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    if(context->tiles[i].queue == NULL && context->tiles[i].branch == NULL) {
+      return i;
+    }
+  }
+  return layout->n_inputs < layout->max_inputs ? (gint)layout->n_inputs : -1;
+}
+
+static LayoutBranch *find_free_branch(LayoutContext *context) {
+  guint i;
+
+  for(i = 0; i < context->n_branches; i++) {
+    if(context->branches[i].location == NULL) {
+      return &context->branches[i];
+    }
+  }
+  return context->n_branches < context->layout->max_inputs ? &context->branches[context->n_branches++] : NULL;
+}
+
+/* A running branch on the input's location that decodes at least as well as it asks */
+static LayoutBranch *find_open_branch(LayoutContext *context, const LayoutInput *input) {
+  LayoutBranch *branch;
+  guint i;
+
+  for(i = 0; i < context->n_branches; i++) {
+    branch = &context->branches[i];
+    if(branch->tee != NULL && !branch->removing && branch->quality <= input->quality &&
+       g_strcmp0(branch->location, input->location) == 0) {
+      return branch;
+    }
+  }
+  return NULL;
+}
+
+static void drop_element(LayoutContext *context, GstElement *element) {
+  gst_element_set_state(element, GST_STATE_NULL);
+  gst_bin_remove(GST_BIN(context->pipeline), element);
+}
+
+/* Removes whatever a tile has built and hands its slot back, the tile keeping its lock */
+static void free_tile_slot(LayoutContext *context, LayoutTile *tile) {
+  guint i;
+
+  if(tile->mixer_pad != NULL) {
+    gst_element_release_request_pad(context->mixer, tile->mixer_pad);
+    gst_object_unref(tile->mixer_pad);
+    tile->mixer_pad = NULL;
+  }
+  for(i = 0; i < G_N_ELEMENTS(tile->elements); i++) {
+    if(tile->elements[i] != NULL) {
+      drop_element(context, tile->elements[i]);
+      tile->elements[i] = NULL;
+    }
+  }
+
+  g_mutex_lock(&tile->stats_lock);
+  tile->buffers_in = 0;
+  tile->buffers_out = 0;
+  tile->latency = 0;
+  tile->static_pixels = 0;
+  g_mutex_unlock(&tile->stats_lock);
+  tile->blended_buffers = 0;
+  tile->area = 0;
+  tile->static_pixels_reported = 0;
+  tile->align_pending = FALSE;
+  tile->segment_seqnum = 0;
+  tile->offset = 0;
+  tile->n_elements = 0;
+  tile->sink = NULL;
+  tile->queue = NULL;
+  tile->cropper = NULL;
+  tile->removing = FALSE;
+  tile->branch = NULL;
+}
+
+/* The same for a branch, which keeps its cancellable for the next input */
+static void free_branch_slot(LayoutContext *context, LayoutBranch *branch) {
+  GCancellable *cancellable = branch->cancellable;
+
+  if(branch->bin != NULL) {
+    drop_element(context, branch->bin);
+  }
+  if(branch->rate != NULL) {
+    drop_element(context, branch->rate);
+  }
+  if(branch->tee != NULL) {
+    drop_element(context, branch->tee);
+  }
+  g_free(branch->location);
+  memset(branch, 0, sizeof(LayoutBranch));
+  branch->context = context;
+  branch->cancellable = cancellable;
+}
+
+/* Undoes a layout_add_input() that failed half way */
+static int abandon_input(LayoutContext *context, LayoutTile *tile, LayoutBranch *branch, gboolean shared) {
+  tile->removing = TRUE;
+  if(shared) {
+    branch->n_tiles--;
+  }
+  else {
+    free_branch_slot(context, branch);
+  }
+  free_tile_slot(context, tile);
+  return -1;
+}
+
+/*
+ * Builds a tile for the input and starts it, downstream first, while the
+ * rest of the pipeline keeps playing. A location that is already open
+ * feeds it from another tee pad, any other gets a branch of its own. The
+ * mixer's output caps stay as they are, so the encoders see no change.
+ * Only a live composite can take one: without live pacing the mixer would
+ * hold the output until the new input delivers.
+ */
+int layout_add_input(LayoutContext *context, const LayoutInput *input) {
+  Layout *layout = context->layout;
+  GstPadTemplate *mixer_sink_pad_template;
+  LayoutInput *added;
+  LayoutTile *tile;
+  LayoutBranch *branch, *shared;
+  gint index, i;
+
+  if(context->remuxing || !layout->live) {
+    g_printerr("Layout '%s' is not composited live, inputs cannot be added to it.\n", layout->name);
+    return -1;
+  }
+  if(find_input(context, input->name) >= 0) {
+    g_printerr("Layout '%s' already has an input called '%s'.\n", layout->name, input->name);
+    return -1;
+  }
+  index = find_free_tile(context);
+  shared = find_open_branch(context, input);
+  branch = index < 0 ? NULL : shared != NULL ? shared : find_free_branch(context);
+  if(branch == NULL) {
+    g_printerr("Layout '%s' has no room for another input.\n", layout->name);
+    return -1;
+  }
+
+  added = &layout->inputs[index];
+  tile = &context->tiles[index];
+  if((guint)index == layout->n_inputs) {
+    g_mutex_init(&tile->stats_lock);
+    layout->n_inputs++;
+  }
+  else {
+    g_free(added->name);
+    g_free(added->location);
+  }
+  *added = *input;
+  added->name = g_strdup(input->name);
+  added->location = g_strdup(input->location);
+
+  if(shared != NULL) {
+    branch->n_tiles++;
+  }
+  else {
+    branch->location = g_strdup(added->location);
+    branch->quality = added->quality;
+    branch->n_tiles = 1;
+  }
+  tile->branch = branch;
+
+  mixer_sink_pad_template = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(context->mixer), "sink_%u");
+  if(build_tile(context, added, tile, mixer_sink_pad_template) != 0 ||
+     (shared == NULL && build_branch(context, layout, branch) != 0)) {
+    return abandon_input(context, tile, branch, shared != NULL);
+  }
+
+  for(i = tile->n_elements - 1; i >= 0; i--) {
+    gst_element_sync_state_with_parent(tile->elements[i]);
+  }
+
+  /* The tee hands the new pad the stream's caps and segment with its next buffer */
+  if(shared != NULL) {
+    if(!gst_element_link(branch->tee, tile->sink)) {
+      build_failed(context, "Could not link the '%s' tee to the '%s' tile.", branch->location, added->name);
+      return abandon_input(context, tile, branch, TRUE);
+    }
+    if(g_atomic_int_get(&branch->down)) {
+      show_tile(context, index, FALSE);
+    }
+    g_print("Added input '%s' sharing '%s'.\n", added->name, added->location);
+    return 0;
+  }
+  /* Downstream first, the input bin last once connect_input() has it connect */
+  if(branch->tee != NULL) {
+    gst_element_sync_state_with_parent(branch->tee);
+  }
+  if(branch->rate != NULL) {
+    gst_element_sync_state_with_parent(branch->rate);
+  }
+  connect_input(branch);
+  g_print("Added input '%s' showing '%s'.\n", added->name, added->location);
+  return 0;
+}
+
+/* Once the EOS has left the tile, nothing flows through it any more */
+static gboolean finish_input_removal(LayoutTile *tile) {
+  LayoutBranch *branch = tile->branch;
+  LayoutContext *context = branch->context;
+
+  g_print("Removed an input showing '%s'.\n", branch->location);
+  if(tile->removal_source != 0) {
+    g_source_remove(tile->removal_source);
+    tile->removal_source = 0;
+  }
+  if(tile->tee_pad != NULL) {
+    gst_element_release_request_pad(branch->tee, tile->tee_pad);
+    gst_object_unref(tile->tee_pad);
+    tile->tee_pad = NULL;
+  }
+
+  /* The last tile takes the branch with it, even one cut at the tee */
+  branch->n_tiles--;
+  if(branch->n_tiles == 0) {
+    if(branch->reconnect_source != 0) {
+      g_source_remove(branch->reconnect_source);
+      branch->reconnect_source = 0;
+    }
+    stop_connecting(branch);
+    free_branch_slot(context, branch);
+  }
+  free_tile_slot(context, tile);
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn watch_tile_eos_probe(GstPad *pad, GstPadProbeInfo *info, LayoutTile *tile) {
+  if(GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS) {
+    g_idle_add((GSourceFunc)finish_input_removal, tile);
+    return GST_PAD_PROBE_REMOVE;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/*
+ * Runs with the tile's feed blocked: cuts the tile loose and ends its
+ * stream, so the mixer pad drains without a flush. A tee keeps feeding the
+ * location's other tiles, a branch of its own stays blocked until it is
+ * stopped.
+ */
+static GstPadProbeReturn cut_tile_probe(GstPad *pad, GstPadProbeInfo *info, LayoutTile *tile) {
+  GstPad *peer = gst_pad_get_peer(pad);
+
+  if(peer == NULL) {
+    return GST_PAD_PROBE_OK;
+  }
+  gst_pad_unlink(pad, peer);
+  gst_pad_send_event(peer, gst_event_new_eos());
+  gst_object_unref(peer);
+  return tile->tee_pad != NULL ? GST_PAD_PROBE_REMOVE : GST_PAD_PROBE_OK;
+}
+
+int layout_remove_input(LayoutContext *context, const gchar *name) {
+  gint index = find_input(context, name);
+  LayoutTile *tile;
+  LayoutBranch *branch;
+  GstPad *queue_pad, *last_pad, *feed_pad;
+
+  if(index < 0) {
+    g_printerr("Layout '%s' has no input called '%s'.\n", context->layout->name, name);
+    return -1;
+  }
+  tile = &context->tiles[index];
+  branch = tile->branch;
+  if(tile->removing) {
+    return 0;
+  }
+  tile->removing = TRUE;
+
+  last_pad = gst_element_get_static_pad(tile->elements[tile->n_elements - 1], "src");
+  gst_pad_add_probe(last_pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback)watch_tile_eos_probe, tile, NULL);
+  gst_object_unref(last_pad);
+
+  /* Shared locations lose one tee pad, others the whole branch */
+  if(branch->n_tiles > 1) {
+    queue_pad = gst_element_get_static_pad(tile->queue, "sink");
+    tile->tee_pad = gst_pad_get_peer(queue_pad);
+    gst_object_unref(queue_pad);
+    feed_pad = gst_object_ref(tile->tee_pad);
+  }
+  else {
+    branch->removing = TRUE;
+    feed_pad = gst_object_ref(branch->ghost_pad);
+  }
+  gst_pad_add_probe(feed_pad, GST_PAD_PROBE_TYPE_IDLE, (GstPadProbeCallback)cut_tile_probe, tile, NULL);
+  gst_object_unref(feed_pad);
+  return 0;
+}
+
+/* Layout switching */
+
+static LayoutInput *find_layout_input(Layout *layout, const gchar *name) {
+  guint i;
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    if(strcmp(layout->inputs[i].name, name) == 0) {
+      return &layout->inputs[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Moves a mixer pad property from one value to another over the transition
+ * through a control source, created on first use. The mixer syncs all its
+ * pads' controlled properties to the stream time of each output frame, so
+ * every tile of a switch changes on the same frame.
+ */
+static void animate_pad_property(GstPad *pad, const gchar *property, gdouble from, gdouble to,
+				 GstClockTime start, GstClockTime transition) {
+  GstControlBinding *binding = gst_object_get_control_binding(GST_OBJECT(pad), property);
+  GstControlSource *source;
+
+  if(binding == NULL) {
+    source = gst_interpolation_control_source_new();
+    g_object_set(source, "mode", GST_INTERPOLATION_MODE_LINEAR, NULL);
+    gst_object_add_control_binding(GST_OBJECT(pad), gst_direct_control_binding_new_absolute(GST_OBJECT(pad), property, source));
+  }
+  else {
+    g_object_get(binding, "control-source", &source, NULL);
+    gst_object_unref(binding);
+  }
+
+  gst_timed_value_control_source_unset_all(GST_TIMED_VALUE_CONTROL_SOURCE(source));
+  if(transition > 0) {
+    gst_timed_value_control_source_set(GST_TIMED_VALUE_CONTROL_SOURCE(source), start, from);
+  }
+  gst_timed_value_control_source_set(GST_TIMED_VALUE_CONTROL_SOURCE(source), start + transition, to);
+  gst_object_unref(source);
+}
+
+/* Decoded frame size reaching the tile, before its crop; 0 until the input has delivered */
+static void get_decoded_size(LayoutTile *tile, gint *width, gint *height) {
+  GstCaps *caps;
+  GstPad *pad = gst_element_get_static_pad(tile->queue, "src");
+
+  *width = 0;
+  *height = 0;
+  if((caps = gst_pad_get_current_caps(pad)) != NULL) {
+    gst_structure_get_int(gst_caps_get_structure(caps, 0), "width", width);
+    gst_structure_get_int(gst_caps_get_structure(caps, 0), "height", height);
+    gst_caps_unref(caps);
+  }
+  gst_object_unref(pad);
+}
+
+/*
+ * Takes the target's crop and size for a tile at once: videocrop and the
+ * tile's caps filter both renegotiate while playing, the mixer pad then
+ * scales the tile from its old rectangle to the new one over the
+ * transition. Without a size the target shows the cropped decoded frame.
+ */
+static void retarget_tile(LayoutContext *context, LayoutTile *tile, LayoutInput *input, const LayoutInput *next,
+			  gint width, gint height) {
+  gint decoded_width, decoded_height;
+  GstCaps *caps;
+
+  input->crop_left = next->crop_left;
+  input->crop_right = next->crop_right;
+  input->crop_top = next->crop_top;
+  input->crop_bottom = next->crop_bottom;
+  if(tile->cropper != NULL) {
+    g_object_set(tile->cropper, "left", input->crop_left, "right", input->crop_right,
+		 "top", input->crop_top, "bottom", input->crop_bottom, NULL);
+  }
+
+  get_decoded_size(tile, &decoded_width, &decoded_height);
+  input->width = next->width > 0 ? next->width :
+    decoded_width > 0 ? decoded_width - input->crop_left - input->crop_right : width;
+  input->height = next->height > 0 ? next->height :
+    decoded_height > 0 ? decoded_height - input->crop_top - input->crop_bottom : height;
+
+  caps = make_video_caps(input->width, input->height, context->format, 0, 0);
+  g_object_set(tile->elements[tile->n_elements - 1], "caps", caps, NULL);
+  gst_caps_unref(caps);
+}
+
+static gboolean remove_faded_input(LayoutTile *tile) {
+  LayoutContext *context = tile->branch->context;
+
+  tile->removal_source = 0;
+  layout_remove_input(context, context->layout->inputs[tile - context->tiles].name);
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Rearranges the running pipeline as the target layout, over transition
+ * milliseconds. Inputs are matched by name and location: those the target
+ * lacks fade out and are removed, giving their slot back, those only the
+ * target has are added and fade in. An input the target shows from another
+ * location is replaced straight away. A matched tile takes the target's
+ * crop and size but keeps its decoding quality. The canvas keeps its size,
+ * the encoders and destinations are not touched.
+ */
+int layout_switch(LayoutContext *context, Layout *target, guint transition) {
+  Layout *layout = context->layout;
+  LayoutInput *input, *next;
+  LayoutTile *tile;
+  gint64 position;
+  gint xpos, ypos, width, height, index;
+  gdouble alpha;
+  guint i;
+  int result = 0;
+
+  if(context->remuxing || !layout->live) {
+    g_printerr("Layout '%s' is not composited live and cannot switch, start from one that is such as single_live.layout.\n",
+	       layout->name);
+    return -1;
+  }
+  if(target->width != layout->width || target->height != layout->height) {
+    g_print("Keeping the %dx%d canvas of '%s', the encoders cannot change size.\n", layout->width, layout->height, layout->name);
+  }
+
+  /* Stream time of the mixer's latest output frame */
+  if(!gst_element_query_position(context->mixer, GST_FORMAT_TIME, &position)) {
+    position = 0;
+  }
+
+  for(i = 0; i < layout->n_inputs; i++) {
+    tile = &context->tiles[i];
+    if(tile->queue == NULL || tile->removing) {
+      continue;
+    }
+    input = &layout->inputs[i];
+    next = find_layout_input(target, input->name);
+    if(next != NULL && strcmp(next->location, input->location) != 0) {
+      layout_remove_input(context, input->name);
+      continue;
+    }
+
+    get_tile_rect(tile, &xpos, &ypos, &width, &height);
+    g_object_get(tile->mixer_pad, "alpha", &alpha, NULL);
+
+    if(tile->removal_source != 0 && next != NULL) {
+      g_source_remove(tile->removal_source);
+      tile->removal_source = 0;
+    }
+    if(next != NULL) {
+      input->xpos = next->xpos;
+      input->ypos = next->ypos;
+      input->zorder = next->zorder;
+      input->alpha = next->alpha;
+      input->qp_offset = next->qp_offset;
+      retarget_tile(context, tile, input, next, width, height);
+    }
+    else {
+      input->alpha = 0.0;
+      if(tile->removal_source == 0) {
+	tile->removal_source = g_timeout_add(transition, (GSourceFunc)remove_faded_input, tile);
+      }
+    }
+
+    /* Copying only holds for a tile that stays opaque all the way */
+    tile->opaque = tile->opaque && alpha >= 1.0 && input->alpha >= 1.0;
+    if(g_object_class_find_property(G_OBJECT_GET_CLASS(tile->mixer_pad), "operator") != NULL) {
+      gst_util_set_object_arg(G_OBJECT(tile->mixer_pad), "operator", tile->opaque ? "source" : "over");
+    }
+    g_object_set(tile->mixer_pad, "zorder", input->zorder + (layout->live ? 1 : 0), NULL);
+    tile->area = (guint64)input->width * input->height;
+
+    animate_pad_property(tile->mixer_pad, "xpos", xpos, input->xpos, position, transition * GST_MSECOND);
+    animate_pad_property(tile->mixer_pad, "ypos", ypos, input->ypos, position, transition * GST_MSECOND);
+    animate_pad_property(tile->mixer_pad, "width", width, input->width, position, transition * GST_MSECOND);
+    animate_pad_property(tile->mixer_pad, "height", height, input->height, position, transition * GST_MSECOND);
+    animate_pad_property(tile->mixer_pad, "alpha", g_atomic_int_get(&tile->branch->down) ? 0.0 : alpha,
+			 input->alpha, position, transition * GST_MSECOND);
+    if(g_atomic_int_get(&tile->branch->down)) {
+      gst_object_set_control_binding_disabled(GST_OBJECT(tile->mixer_pad), "alpha", TRUE);
+    }
+  }
+
+  for(i = 0; i < target->n_inputs; i++) {
+    if(find_input(context, target->inputs[i].name) >= 0) {
+      continue;
+    }
+    if(layout_add_input(context, &target->inputs[i]) != 0) {
+      g_printerr("Switching '%s' to '%s' goes on without its input '%s'.\n", layout->name, target->name, target->inputs[i].name);
+      result = -1;
+      continue;
+    }
+    index = find_input(context, target->inputs[i].name);
+    tile = &context->tiles[index];
+    animate_pad_property(tile->mixer_pad, "alpha", 0.0, layout->inputs[index].alpha, position, transition * GST_MSECOND);
+    if(g_atomic_int_get(&tile->branch->down)) {
+      gst_object_set_control_binding_disabled(GST_OBJECT(tile->mixer_pad), "alpha", TRUE);
+    }
+  }
+
+  g_print("Switching '%s' to '%s' over %u ms.\n", layout->name, target->name, transition);
+  return result;
+}
+
+/*
+ * Moves a switcher layout's output to the named input. The cut itself
+ * happens in cut_on_keyframe_probe() at the input's next keyframe, so it
+ * lags the request by up to one GOP of that input; a newer request
+ * replaces one still waiting.
+ */
+int layout_cut(LayoutContext *context, const gchar *name) {
+  LayoutBranch *branch = NULL;
+  GstPad *active_pad;
+  guint i;
+
+  if(context->selector == NULL) {
+    g_printerr("Layout '%s' is not a switcher.\n", context->layout->name);
+    return -1;
+  }
+  for(i = 0; i < context->layout->n_inputs && branch == NULL; i++) {
+    if(strcmp(context->layout->inputs[i].name, name) == 0) {
+      branch = context->tiles[i].branch;
+    }
+  }
+  if(branch == NULL) {
+    g_printerr("Layout '%s' has no input called '%s'.\n", context->layout->name, name);
+    return -1;
+  }
+
+  g_object_get(context->selector, "active-pad", &active_pad, NULL);
+  if(active_pad != NULL) {
+    gst_object_unref(active_pad);
+  }
+  if(active_pad == branch->selector_pad) {
+    g_atomic_pointer_set(&context->cut_branch, NULL);
+    g_print("Already showing '%s'.\n", name);
+    return 0;
+  }
+
+  context->cut_time = g_get_monotonic_time();
+  g_atomic_pointer_set(&context->cut_branch, branch);
+  g_print("Cutting to '%s' at its next keyframe.\n", name);
+  return 0;
+}
+
+void layout_cb_message(GstBus *bus, GstMessage *msg, LayoutContext *context) {
+  switch (GST_MESSAGE_TYPE(msg)) {
+  case GST_MESSAGE_ERROR: {
+    GError *err;
+    gchar *debug;
+    LayoutDestination *destination;
+    LayoutBranch *branch;
+
+    gst_message_parse_error(msg, &err, &debug);
+    g_print ("Error from '%s': %s\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), err->message);
+    g_error_free (err);
+    g_free (debug);
+
+    /* A failed output only takes itself down while others are still running */
+    destination = find_destination(context, GST_MESSAGE_SRC(msg));
+    if(destination != NULL) {
+      remove_destination(destination);
+      if(context->n_active_destinations > 0) {
+	break;
+      }
+    }
+
+    /* A failed input reconnects on its own, the show goes on without it */
+    branch = find_branch(context, GST_MESSAGE_SRC(msg));
+    if(branch != NULL) {
+      lose_input(branch);
+      break;
+    }
+
+    gst_element_set_state(context->pipeline, GST_STATE_READY);
+    g_main_loop_quit (context->loop);
+    break;
+  }
+  case GST_MESSAGE_EOS:
+    /* end-of-stream */
+    gst_element_set_state (context->pipeline, GST_STATE_READY);
+    g_main_loop_quit (context->loop);
+    break;
+  case GST_MESSAGE_BUFFERING: {
+    gint percent = 0;
+
+    /* If the stream is live, we do not care about buffering. */
+    if (context->is_live) break;
+
+    gst_message_parse_buffering (msg, &percent);
+    g_print ("Buffering (%3d%%)\r", percent);
+    /* Wait until buffering is complete before start/resume playing */
+    if (percent < 100)
+      gst_element_set_state (context->pipeline, GST_STATE_PAUSED);
+    else
+      gst_element_set_state (context->pipeline, GST_STATE_PLAYING);
+    break;
+  }
+  case GST_MESSAGE_CLOCK_LOST:
+    /* Get a new clock */
+    gst_element_set_state (context->pipeline, GST_STATE_PAUSED);
+    gst_element_set_state (context->pipeline, GST_STATE_PLAYING);
+    break;
+  case GST_MESSAGE_STATE_CHANGED:
+    if(GST_MESSAGE_SRC(msg) == GST_OBJECT(context->pipeline)) {
+      GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(context->pipeline), GST_DEBUG_GRAPH_SHOW_MEDIA_TYPE, "playing");
+    }
+    break;
+  default:
+    /* Unhandled message */
+    break;
+  }
+}
+
+void layout_pad_added_handler(GstElement *source, GstPad *pad, LayoutBranch *branch) {
+  GstPad *sink_pad = branch->ghost_pad != NULL ? gst_object_ref(branch->ghost_pad) : gst_element_get_static_pad(branch->sink, "sink");
+  GstPad *target;
+  GstPadLinkReturn retval;
+  GstCaps *new_pad_caps = NULL;
+  const gchar *new_pad_type = NULL, *new_pad_format;
+
+  g_print("Received new pad '%s' from '%s'\n", GST_PAD_NAME(pad), GST_ELEMENT_NAME(source));
+  new_pad_caps = gst_pad_query_caps(pad, NULL);
+  new_pad_type = gst_structure_get_name(gst_caps_get_structure(new_pad_caps, 0));
+
+  if(!g_str_has_prefix(new_pad_type, branch->media_type)) {
+    g_print("Ignoring pad of type '%s'\n", new_pad_type);
+    goto exit;
+  }
+
+  /* Input bins hand the pad out through their ghost pad */
+  if(branch->ghost_pad != NULL) {
+    target = gst_ghost_pad_get_target(GST_GHOST_PAD(sink_pad));
+    if(target != NULL) {
+      gst_object_unref(target);
+      g_print("Video pad linked already\n");
+      goto exit;
+    }
+    retval = gst_ghost_pad_set_target(GST_GHOST_PAD(sink_pad), pad) ? GST_PAD_LINK_OK : GST_PAD_LINK_REFUSED;
+  }
+  else if(gst_pad_is_linked(sink_pad)) {
+    g_print("Video pad linked already\n");
+    goto exit;
+  }
+  else {
+    retval = gst_pad_link(pad, sink_pad);
+  }
+  if(GST_PAD_LINK_FAILED(retval)) {
+    g_print("Type is '%s', but linking failed\n", new_pad_type);
+  }
+  else {
+    g_print("Link succeeded with type '%s'.\n", new_pad_type);
+  }
+
+  /* Whether the decoder kept to the planned format, see plan_format() */
+  new_pad_format = gst_structure_get_string(gst_caps_get_structure(new_pad_caps, 0), "format");
+  if(branch->format != NULL && new_pad_format != NULL) {
+    if(strcmp(new_pad_format, branch->format) == 0) {
+      g_print("'%s' decodes to %s, its tiles need no conversion.\n", branch->location, new_pad_format);
+    }
+    else {
+      g_print("'%s' decodes to %s, its tiles convert it to %s.\n", branch->location, new_pad_format, branch->format);
+    }
+  }
+
+ exit:
+  if(new_pad_caps != NULL) {
+    gst_caps_unref(new_pad_caps);
+  }
+  gst_object_unref(sink_pad);
+}
@@ -0,0 +1,381 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+/*
+ * Data-driven compositor layouts.
+ *
+ * A layout file describes the canvas, the output and one group per input
+ * tile, e.g.
+ *
+ *   [layout]
+ *   name=quad
+ *   width=640
+ *   height=360
+ *
+ *   [output]
+ *   location=rtmp://192.168.1.124:1935/yanked/stream-videotestsrc
+ *
+ *   [input top_left]
+ *   location=rtmp://192.168.1.124:1935/yanked/stream-counter
+ *   xpos=0
+ *   ypos=0
+ *   width=320
+ *   height=180
+ *
+ * Several output locations can be given separated by ';', the stream is
+ * encoded once and sent to all of them. A location of throttle:BYTES stands
+ * in for an uplink of BYTES per second, to try out congestion locally, and
+ * file:PATH records the FLV stream to a file.
+ * Extra [rendition NAME] groups with width, height, bitrate and location add
+ * smaller encodings of the same composite, each rung scaled from the next
+ * larger one.
+ *
+ * A running pipeline can be rearranged as another layout with
+ * layout_switch(), inputs being matched by name and location. Layouts meant
+ * to be switched between name their inputs after the role of the source
+ * rather than the tile's place: the shipped ones call the show's camera
+ * "main" and the judges' feeds "judge1" to "judge3", so a tile glides to
+ * its new place instead of being faded out and reconnected. Inputs of a
+ * live layout can also be added and removed one by one, up to max-inputs
+ * at a time. Locations shown by several tiles are opened once.
+ *
+ * A switcher layout shows one input at a time without decoding anything:
+ * every input is remuxed into the output through an input-selector, and
+ * layout_cut() moves the output to another input at its next keyframe.
+ *
+ * Inputs connect in parallel once layout_connect_inputs() is called on the
+ * playing pipeline. An input that errors out, ends, or has not delivered a
+ * frame connect-timeout seconds after an attempt started is reconnected on
+ * its own with an increasing delay, its tiles going transparent until it is
+ * back. A layout with a canvas is composited live, so the output goes on
+ * without inputs that are not there; it starts once the first input, the
+ * main one, has delivered, or after connect-timeout without it.
+ *
+ * Other keys:
+ *   [layout]  format, framerate, passthrough, fast-start, connect-timeout,
+ *             max-inputs, queue-time, queue-leaky, stats-interval, live,
+ *             latency, slate, switcher
+ *   [output]  bitrate, queue-time, adaptive,
+ *             profile (zero-latency, balanced or archive),
+ *             encoder (x264enc or vaapih264enc)
+ *   [input]   zorder, alpha, crop-left/right/top/bottom, queue-time,
+ *             queue-leaky (no, upstream or downstream),
+ *             quality (full, fast or keyframes), qp-offset
+ *
+ * See configs/layouts/ for the single, split, pip, quad, judge and judge_live
+ * layouts.
+ */
+
+/* Same values as the queue element's leaky property */
+typedef enum {
+  LAYOUT_LEAKY_NONE,
+  LAYOUT_LEAKY_UPSTREAM,
+  LAYOUT_LEAKY_DOWNSTREAM
+} LayoutLeaky;
+
+/*
+ * How much decoding an input gets, from a full decode to keyframes only.
+ * Small tiles hardly show what the cheaper modes leave out. fast only skips
+ * B-frames, so it saves nothing on streams encoded without them.
+ */
+typedef enum {
+  LAYOUT_QUALITY_FULL,
+  LAYOUT_QUALITY_FAST,
+  LAYOUT_QUALITY_KEYFRAMES
+} LayoutQuality;
+
+/* Encoder settings, trading compression for latency */
+typedef enum {
+  LAYOUT_PROFILE_ZERO_LATENCY,
+  LAYOUT_PROFILE_BALANCED,
+  LAYOUT_PROFILE_ARCHIVE
+} LayoutProfile;
+
+/*
+ * H.264 encoder of every rendition. Only vaapih264enc turns the tiles'
+ * qp-offset into quantizer offsets, x264enc ignores them.
+ */
+typedef enum {
+  LAYOUT_ENCODER_X264,
+  LAYOUT_ENCODER_VAAPI
+} LayoutEncoder;
+
+typedef struct _LayoutInput {
+  gchar *name;
+  gchar *location;
+  /* Tile rectangle on the canvas, width/height of 0 keep the decoded size */
+  gint xpos, ypos;
+  gint width, height;
+  gint zorder;
+  gdouble alpha;
+  /* Pixels removed from each edge of the decoded frame before scaling */
+  gint crop_left, crop_right, crop_top, crop_bottom;
+  /* Queue in front of the mixer pad: milliseconds held and what to drop when full */
+  gint queue_time;
+  LayoutLeaky queue_leaky;
+  LayoutQuality quality;
+  /* Quantizer offset the encoder is asked to apply to the tile, negative for more bits */
+  gint qp_offset;
+} LayoutInput;
+
+/* One encoding of the composite, [output] is the first, full size rendition */
+typedef struct _LayoutRendition {
+  gchar *name;
+  gint width, height;
+  /* Encoder bitrate in kbit/s, 0 keeps the encoder default */
+  gint bitrate;
+  gchar **locations;
+} LayoutRendition;
+
+typedef struct _Layout {
+  gchar *name;
+  /* Output caps, 0 or NULL leave the value to negotiation */
+  gint width, height;
+  gchar *format;
+  gint framerate_n, framerate_d;
+  LayoutRendition *renditions;
+  guint n_renditions;
+  /* Encoder and encoder profile for every rendition */
+  LayoutEncoder encoder;
+  LayoutProfile profile;
+  /* Follow the output queues with the encoder bitrate, see layout_adapt_bitrate() */
+  gboolean adaptive;
+  /*
+   * Most of the stream, in milliseconds, buffered for each output location.
+   * Past it whole GOPs are dropped before they are queued, so a slow uplink
+   * never gets a GOP with its first frames missing.
+   */
+  gint output_queue_time;
+  /* Allow remuxing a lone, untouched input instead of decoding it */
+  gboolean passthrough;
+  /* Remux the inputs one at a time instead of compositing them */
+  gboolean switcher;
+  /* Decode inputs with a fixed flvdemux ! h264parse ! decoder chain, not decodebin */
+  gboolean fast_start;
+  /* Seconds an input may take to connect or go silent before it is reconnected */
+  gint connect_timeout;
+  /* Inputs the layout can have at once, removed ones giving their slot back */
+  guint max_inputs;
+  /* Defaults for the inputs' queue-time and queue-leaky keys */
+  gint queue_time;
+  LayoutLeaky queue_leaky;
+  /* Seconds between tile statistics printouts, 0 for none */
+  gint stats_interval;
+  /*
+   * Live compositing, the default with a canvas size: frames go out at the
+   * layout framerate on the pipeline clock, latency milliseconds after
+   * capture, whether or not every input has delivered. Late tiles repeat
+   * their last frame over the slate, a videotestsrc pattern filling the
+   * canvas. Only a single input can do without, the mixer would otherwise
+   * wait on the slowest one.
+   */
+  gboolean live;
+  gint latency;
+  gchar *slate;
+  LayoutInput *inputs;
+  guint n_inputs;
+} Layout;
+
+/*
+ * Output queue fill, in percent of its queue-time, above which the bitrate
+ * is cut, below which it creeps back up, and above which a destination only
+ * gets keyframes until it has drained below the low mark again.
+ */
+#define LAYOUT_ADAPT_INTERVAL 500
+#define LAYOUT_ADAPT_HIGH_FILL 50
+#define LAYOUT_ADAPT_LOW_FILL 10
+#define LAYOUT_ADAPT_CONGESTED_FILL 75
+
+/* Delay before reconnecting a lost input, doubled after each failed attempt */
+#define LAYOUT_RECONNECT_MIN_BACKOFF 500
+#define LAYOUT_RECONNECT_MAX_BACKOFF 30000
+
+typedef struct _LayoutContext LayoutContext;
+
+/*
+ * One opened location: its demuxer and the element its video pad gets linked
+ * to. Tiles showing the same location share a branch, which then ends in a
+ * tee so the stream is fetched and decoded only once.
+ */
+typedef struct _LayoutBranch {
+  LayoutContext *context;
+  /* NULL once the branch's last tile has been removed, the slot is free */
+  gchar *location;
+  /* rtmpsrc and decodebin, restarted on their own when the input is lost */
+  GstElement *bin;
+  GstPad *ghost_pad;
+  /* decodebin, or flvdemux followed by parser when starting fast */
+  GstElement *source;
+  GstElement *parser;
+  /* Splits the stream between the tiles, NULL for the single tile of a layout that is not live */
+  GstElement *tee;
+  /* decodebin plugged in when a fast start input turns out not to be H.264 */
+  GstElement *fallback;
+  gboolean fast_start;
+  GstElement *sink;
+  /* Drops frames beyond the layout framerate, NULL when it is not set */
+  GstElement *rate;
+  /* Media type of the pad to link, video/x-raw unless remuxing */
+  const gchar *media_type;
+  /* Planned raw video format, NULL unless decoding */
+  const gchar *format;
+  /* Best quality any of its tiles asks for */
+  LayoutQuality quality;
+  guint n_tiles;
+  /* Reconnection state: down is cleared by the first buffer after a restart */
+  gint down;
+  gint64 down_since;
+  guint backoff;
+  guint reconnect_source;
+  guint reconnects;
+  /* Microseconds from losing the input to its first frame back */
+  gint64 reconnect_time;
+  /* Microseconds from starting the pipeline to the input's first frame */
+  gint64 first_frame_time;
+  /* Thread connecting the input, and how long its last connection took */
+  GThread *connect_thread;
+  gint64 connect_time;
+  /*
+   * The current attempt: connecting while its thread is in connect(), waiting
+   * until its first frame, the deadline source after connect-timeout seconds
+   */
+  gint connecting;
+  gint waiting;
+  guint deadline_source;
+  GCancellable *cancellable;
+  /* Being taken out of a running pipeline, see layout_remove_input() */
+  gboolean removing;
+  /* Switcher layouts: the branch's input-selector pad */
+  GstPad *selector_pad;
+} LayoutBranch;
+
+/* What a tile's queue has seen so far, see layout_get_tile_stats() */
+typedef struct _LayoutTileStats {
+  guint level_buffers;
+  GstClockTime level_time;
+  guint64 buffers_in;
+  guint64 buffers_out;
+  guint64 dropped;
+  /* How far behind the pipeline clock the last frame left the queue */
+  GstClockTimeDiff latency;
+  /* Memory traffic avoided by scaling and converting in one pass */
+  guint64 bytes_saved;
+  /* Pixels blended into output frames although the tile had not changed */
+  guint64 static_pixels;
+} LayoutTileStats;
+
+/* The per-input chain from a branch to its mixer pad */
+typedef struct _LayoutTile {
+  /* NULL once the tile has been removed, the slot is free for another input */
+  LayoutBranch *branch;
+  GstElement *sink;
+  GstElement *queue;
+  GstPad *mixer_pad;
+  /* videocrop, always there in a live layout so a switch can change the crop */
+  GstElement *cropper;
+  GstElement *elements[5];
+  guint n_elements;
+  /* The tee pad feeding a tile that is being removed */
+  GstPad *tee_pad;
+  gboolean removing;
+  /* Main loop only: a switch faded the tile out, it is removed once this fires */
+  guint removal_source;
+  /* Updated from the streaming threads under stats_lock */
+  GMutex stats_lock;
+  guint64 buffers_in;
+  guint64 buffers_out;
+  GstClockTimeDiff latency;
+  GstSegment segment;
+  guint64 static_pixels;
+  /* Mixer thread only: buffers_out at the previous output frame, tile size */
+  guint64 blended_buffers;
+  guint64 area;
+  /* Main loop only: static_pixels at the previous statistics printout */
+  guint64 static_pixels_reported;
+  /*
+   * Live mode moves each new segment onto the pipeline clock, once: the
+   * copy gst_pad_set_offset() resends keeps the seqnum of the aligned one
+   */
+  gboolean align_to_clock;
+  gboolean align_pending;
+  guint32 segment_seqnum;
+  GstClockTimeDiff offset;
+  /* Copied onto the canvas rather than blended */
+  gboolean opaque;
+  /* Scaled and converted by a single videoconvertscale */
+  gboolean fused;
+} LayoutTile;
+
+/* One output location behind a tee, failed once its sink has errored out */
+typedef struct _LayoutDestination {
+  LayoutContext *context;
+  gchar *location;
+  GstElement *tee;
+  GstElement *queue;
+  GstElement *sink;
+  GstPad *tee_pad;
+  gint failed;
+  gboolean removed;
+  /* The rendition's encoder, shared with its other destinations, NULL when remuxing */
+  GstElement *encoder;
+  /* Configured bitrate, the most the adaptation goes back up to */
+  guint max_bitrate;
+  /* queue-time, the queue itself holds twice that before it leaks */
+  GstClockTime max_time;
+  /* Set by layout_adapt_bitrate(), dropping follows it from keyframe to keyframe */
+  gint congested;
+  gboolean dropping;
+  guint64 frames_dropped;
+} LayoutDestination;
+
+struct _LayoutContext {
+  GstElement *pipeline;
+  gboolean is_live;
+  GMainLoop *loop;
+  Layout *layout;
+  GstElement *mixer;
+  LayoutBranch *branches;
+  guint n_branches;
+  /* One per layout input, in the same order, with room for max_inputs */
+  LayoutTile *tiles;
+  LayoutDestination *destinations;
+  guint n_destinations;
+  guint n_active_destinations;
+  gboolean remuxing;
+  /* Switcher layouts: the branch to cut to at its next keyframe, and when that was asked for */
+  GstElement *selector;
+  LayoutBranch *cut_branch;
+  gint64 cut_time;
+  /* Set once layout_build() succeeded, later build failures leave the pipeline alone */
+  gboolean built;
+  /* Raw video format used from the decoders to the encoders */
+  gchar *format;
+  /* Monotonic time when the pipeline was started, for the CPU report and the main input's wait */
+  gint64 start_time;
+  /* Monotonic time of the previous statistics printout */
+  gint64 stats_time;
+};
+
+Layout *layout_load(const gchar *path, GError **error);
+void layout_free(Layout *layout);
+gboolean layout_can_remux(Layout *layout);
+
+int layout_build(LayoutContext *context, Layout *layout);
+void layout_cb_message(GstBus *bus, GstMessage *msg, LayoutContext *context);
+GstBusSyncReply layout_bus_sync_handler(GstBus *bus, GstMessage *msg, LayoutContext *context);
+void layout_pad_added_handler(GstElement *source, GstPad *pad, LayoutBranch *branch);
+void layout_connect_inputs(LayoutContext *context);
+int layout_add_input(LayoutContext *context, const LayoutInput *input);
+int layout_remove_input(LayoutContext *context, const gchar *name);
+int layout_switch(LayoutContext *context, Layout *target, guint transition);
+int layout_cut(LayoutContext *context, const gchar *name);
+void layout_context_clear(LayoutContext *context);
+void layout_print_cpu_usage(LayoutContext *context);
+gboolean layout_get_tile_stats(LayoutContext *context, guint index, LayoutTileStats *stats);
+gboolean layout_print_tile_stats(LayoutContext *context);
+gboolean layout_adapt_bitrate(LayoutContext *context);
+
+#endif
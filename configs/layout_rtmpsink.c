@@ -0,0 +1,157 @@
+#include <gst/gst.h>
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "layout.h"
+
+/*
+ * Builds and runs the pipeline described by a layout file.
+ *
+ *   gcc -o layout_rtmpsink layout_rtmpsink.c layout.c $(pkg-config --cflags --libs gstreamer-1.0 gstreamer-video-1.0 gstreamer-controller-1.0 gio-2.0)
+ *   ./layout_rtmpsink layouts/quad.layout [rtmp://host/app/output ...]
+ *   ./layout_rtmpsink layouts/quad_adaptive.layout throttle:40000
+ *
+ * Inputs can be added and removed while it runs by typing, one per line:
+ *
+ *   add NAME LOCATION XPOS YPOS WIDTH HEIGHT [ZORDER]
+ *   remove NAME
+ *   switch LAYOUT_FILE [TRANSITION_MS]
+ *   cut NAME (switcher layouts)
+ */
+
+/* Ctrl-C stops the pipeline cleanly so the CPU report still gets printed */
+static gboolean handle_interrupt(LayoutContext *context) {
+  g_print("Interrupted, stopping.\n");
+  g_main_loop_quit(context->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean handle_command(GIOChannel *channel, GIOCondition condition, LayoutContext *context) {
+  LayoutInput input;
+  Layout *target;
+  GError *error = NULL;
+  guint transition = 0;
+  gchar *line = NULL;
+  gchar name[64], location[1024];
+  GIOStatus status;
+
+  status = g_io_channel_read_line(channel, &line, NULL, NULL, NULL);
+  if(status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR) {
+    return G_SOURCE_REMOVE;
+  }
+  if(line == NULL) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  memset(&input, 0, sizeof(input));
+  input.alpha = 1.0;
+  input.queue_time = context->layout->queue_time;
+  input.queue_leaky = context->layout->queue_leaky;
+  if(sscanf(line, "add %63s %1023s %d %d %d %d %d", name, location, &input.xpos, &input.ypos,
+	    &input.width, &input.height, &input.zorder) >= 6) {
+    input.name = name;
+    input.location = location;
+    layout_add_input(context, &input);
+  }
+  else if(sscanf(line, "remove %63s", name) == 1) {
+    layout_remove_input(context, name);
+  }
+  else if(sscanf(line, "switch %1023s %u", location, &transition) >= 1) {
+    target = layout_load(location, &error);
+    if(target == NULL) {
+      g_printerr("Could not load layout '%s': %s\n", location, error->message);
+      g_error_free(error);
+    }
+    else {
+      layout_switch(context, target, transition);
+      layout_free(target);
+    }
+  }
+  else if(sscanf(line, "cut %63s", name) == 1) {
+    layout_cut(context, name);
+  }
+  else {
+    g_printerr("Unknown command: %s", line);
+  }
+  g_free(line);
+  return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char *argv[]) {
+  GstBus *bus;
+  GIOChannel *commands;
+  GstStateChangeReturn return_value;
+  GError *error = NULL;
+  Layout *layout;
+  LayoutContext context;
+
+  gst_init(&argc, &argv);
+  memset(&context, 0, sizeof(context));
+
+  if(argc < 2) {
+    g_printerr("Usage: %s LAYOUT_FILE [OUTPUT_LOCATION...]\n", argv[0]);
+    return -1;
+  }
+
+  layout = layout_load(argv[1], &error);
+  if(layout == NULL) {
+    g_printerr("Could not load layout '%s': %s\n", argv[1], error->message);
+    g_error_free(error);
+    return -1;
+  }
+
+  if(argc > 2) {
+    g_strfreev(layout->renditions[0].locations);
+    layout->renditions[0].locations = g_strdupv(&argv[2]);
+  }
+
+  if(layout_build(&context, layout) != 0) {
+    layout_context_clear(&context);
+    layout_free(layout);
+    return -1;
+  }
+
+  bus = gst_element_get_bus(context.pipeline);
+  context.start_time = g_get_monotonic_time();
+  return_value = gst_element_set_state(context.pipeline, GST_STATE_PLAYING);
+
+  if(return_value == GST_STATE_CHANGE_FAILURE) {
+    g_printerr("Unable to set the pipeline to the playing state.\n");
+    gst_object_unref(bus);
+    layout_context_clear(&context);
+    layout_free(layout);
+    return -1;
+  }
+  else if(return_value == GST_STATE_CHANGE_NO_PREROLL) {
+    context.is_live = TRUE;
+  }
+  layout_connect_inputs(&context);
+
+  context.loop = g_main_loop_new(NULL, FALSE);
+
+  gst_bus_add_signal_watch(bus);
+  g_signal_connect(bus, "message", G_CALLBACK(layout_cb_message), &context);
+  g_unix_signal_add(SIGINT, (GSourceFunc)handle_interrupt, &context);
+  commands = g_io_channel_unix_new(STDIN_FILENO);
+  g_io_add_watch(commands, G_IO_IN, (GIOFunc)handle_command, &context);
+  if(layout->stats_interval > 0) {
+    g_timeout_add_seconds(layout->stats_interval, (GSourceFunc)layout_print_tile_stats, &context);
+  }
+  if(layout->adaptive) {
+    g_timeout_add(LAYOUT_ADAPT_INTERVAL, (GSourceFunc)layout_adapt_bitrate, &context);
+  }
+
+  g_main_loop_run(context.loop);
+  GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(context.pipeline), GST_DEBUG_GRAPH_SHOW_MEDIA_TYPE, "aftermainlooprun");
+  g_main_loop_unref(context.loop);
+  g_io_channel_unref(commands);
+  layout_print_cpu_usage(&context);
+  gst_bus_remove_signal_watch(bus);
+  gst_object_unref(bus);
+  layout_context_clear(&context);
+  layout_free(layout);
+  return 0;
+}
@@ -10,6 +10,7 @@ public class HelloInContext {
     private static Pointer context = null;
 
     public interface GstTest extends Library {
+	public int prewarm(int count);
 	public Pointer allocate();
 	public int setup(String source, String sink, Pointer context);
 	public int start(Pointer context);
@@ -18,6 +19,8 @@ public class HelloInContext {
 
     public static void main(String argv[]) {
 	GstTest gst = (GstTest)Native.loadLibrary("hello_in_context", GstTest.class);
+	// Builds a pipeline ahead of time, setup() then only sets the locations
+	gst.prewarm(1);
 	context = gst.allocate();
 	if(context != null) {
 	    String source = "rtmp://192.168.1.114:1935/yanked/stream-fancy";
@@ -9,8 +9,26 @@ typedef struct _GstContext {
   GstElement *sink;
   gboolean is_live;
   GMainLoop *loop;
+  /* Re-targeted at every setup() when the pipeline comes from the pool */
+  GstElement *rtmp_source;
+  GstElement *rtmp_sink;
+  /* Monotonic time of setup(), for the first frame report */
+  gint64 setup_time;
+  gboolean pooled;
+  gulong first_frame_probe;
 } GstContext;
 
+/*
+ * Pipelines built ahead of time by prewarm() and given back by start() once
+ * stopped, all waiting in READY: elements made, plugins loaded and links
+ * done, so setup() only has to set the locations.
+ */
+#define POOL_SIZE 4
+
+static GMutex pool_lock;
+static GstContext *pool[POOL_SIZE];
+static guint pool_size;
+
 
 static void cb_message(GstBus *bus, GstMessage *msg, GstContext *data) {
   switch (GST_MESSAGE_TYPE(msg)) {
@@ -103,12 +121,12 @@ static void pad_added_handler(GstElement *source, GstPad *pad, GstContext *data)
 GstContext* allocate() {
   GstContext* context;
   gst_init(NULL, NULL);
-  context = (GstContext *)malloc(sizeof(GstContext));
+  context = (GstContext *)calloc(1, sizeof(GstContext));
   printf("%s", "Set up the struct and returning the pointer.\n");
   return context;
 }
 
-int setup(const char* rtmp_source, const char* rtmp_sink, GstContext *context) {
+static int build(GstContext *context) {
   GstElement *source, *sink, *encoder, *muxer;
 
   source = gst_element_factory_make("rtmpsrc", "source");
@@ -127,10 +145,19 @@ int setup(const char* rtmp_source, const char* rtmp_sink, GstContext *context) {
 
   gst_bin_add_many(GST_BIN(context->pipeline), source, sink, encoder, muxer,\
 		   context->source, context->sink, NULL);
+  context->rtmp_source = source;
+  context->rtmp_sink = sink;
 
-  g_object_set(source, "location", rtmp_source, NULL);
-  g_object_set(sink, "location", rtmp_sink, NULL);
-  g_object_set(encoder, "bframes", 0, NULL);
+  /*
+   * A relay has no use for lookahead, which holds frames back for seconds.
+   * Same settings as the layouts' zero-latency profile, whose keyframe every
+   * second is 25 frames at the 25 fps the publishers send; the caps are not
+   * known yet here.
+   */
+  gst_util_set_object_arg(G_OBJECT(encoder), "tune", "zerolatency");
+  gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", "superfast");
+  g_object_set(encoder, "bframes", 0, "rc-lookahead", 0, "sync-lookahead", 0, "sliced-threads", TRUE,
+	       "key-int-max", 25, "vbv-buf-capacity", 250, NULL);
 
   if(!gst_element_link(source, context->source)) {
     g_printerr("Could not link RTMP source to the decoder.\n");
@@ -156,7 +183,133 @@ int setup(const char* rtmp_source, const char* rtmp_sink, GstContext *context) {
     return -1;
   }
 
+  return 0;
+}
+
+static GstPadProbeReturn first_frame_probe(GstPad *pad, GstPadProbeInfo *info, GstContext *context) {
+  g_print("First frame %" G_GINT64_FORMAT " ms after setup (%s pipeline).\n",
+	  (g_get_monotonic_time() - context->setup_time) / 1000, context->pooled ? "pre-warmed" : "new");
+  context->first_frame_probe = 0;
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Builds up to count pipelines into the pool, returns how many it holds */
+int prewarm(int count) {
+  GstContext *context;
+  guint size;
+  int i;
+
+  gst_init(NULL, NULL);
+  for(i = 0; i < count; i++) {
+    context = (GstContext *)calloc(1, sizeof(GstContext));
+    if(build(context) != 0) {
+      free(context);
+      break;
+    }
+    if(gst_element_set_state(context->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+      g_printerr("Could not pre-warm a pipeline.\n");
+      gst_element_set_state(context->pipeline, GST_STATE_NULL);
+      gst_object_unref(context->pipeline);
+      free(context);
+      break;
+    }
+
+    g_mutex_lock(&pool_lock);
+    if(pool_size < POOL_SIZE) {
+      pool[pool_size++] = context;
+      context = NULL;
+    }
+    g_mutex_unlock(&pool_lock);
+    if(context != NULL) {
+      gst_element_set_state(context->pipeline, GST_STATE_NULL);
+      gst_object_unref(context->pipeline);
+      free(context);
+      break;
+    }
+  }
+
+  g_mutex_lock(&pool_lock);
+  size = pool_size;
+  g_mutex_unlock(&pool_lock);
+  printf("%u pipeline(s) ready.\n", size);
+  return size;
+}
+
+/* Puts a stopped pipeline back into the pool, or frees it when the pool is full */
+static void release(GstContext *context) {
+  GstContext *pooled = NULL;
+  GstBus *bus;
+
+  if(context->first_frame_probe != 0) {
+    GstPad *pad = gst_element_get_static_pad(context->sink, "sink");
+    gst_pad_remove_probe(pad, context->first_frame_probe);
+    gst_object_unref(pad);
+  }
+  g_signal_handlers_disconnect_by_func(context->source, pad_added_handler, context);
+
+  /* READY drops what decodebin plugged and resets the encoder and the RTMP connections */
+  if(gst_element_set_state(context->pipeline, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE) {
+    g_mutex_lock(&pool_lock);
+    if(pool_size < POOL_SIZE) {
+      pooled = (GstContext *)calloc(1, sizeof(GstContext));
+      *pooled = *context;
+      pooled->first_frame_probe = 0;
+      pool[pool_size++] = pooled;
+    }
+    g_mutex_unlock(&pool_lock);
+  }
+
+  if(pooled == NULL) {
+    gst_element_set_state(context->pipeline, GST_STATE_NULL);
+    gst_object_unref(context->pipeline);
+    return;
+  }
+
+  /* Messages left from this run must not reach the next one */
+  bus = gst_element_get_bus(context->pipeline);
+  gst_bus_set_flushing(bus, TRUE);
+  gst_bus_set_flushing(bus, FALSE);
+  gst_object_unref(bus);
+  printf("%s", "Pipeline returned to the pool.\n");
+}
+
+int setup(const char* rtmp_source, const char* rtmp_sink, GstContext *context) {
+  GstContext *pooled = NULL;
+  GstPad *pad;
+
+  context->setup_time = g_get_monotonic_time();
+  context->is_live = FALSE;
+
+  g_mutex_lock(&pool_lock);
+  if(pool_size > 0) {
+    pooled = pool[--pool_size];
+  }
+  g_mutex_unlock(&pool_lock);
+
+  if(pooled != NULL) {
+    context->pipeline = pooled->pipeline;
+    context->source = pooled->source;
+    context->sink = pooled->sink;
+    context->rtmp_source = pooled->rtmp_source;
+    context->rtmp_sink = pooled->rtmp_sink;
+    free(pooled);
+    context->pooled = TRUE;
+    printf("%s", "Claimed a pre-warmed pipeline.\n");
+  }
+  else if(build(context) != 0) {
+    return -1;
+  }
+  else {
+    context->pooled = FALSE;
+  }
+
+  g_object_set(context->rtmp_source, "location", rtmp_source, NULL);
+  g_object_set(context->rtmp_sink, "location", rtmp_sink, NULL);
   g_signal_connect(context->source, "pad-added", G_CALLBACK(pad_added_handler), context);
+
+  pad = gst_element_get_static_pad(context->sink, "sink");
+  context->first_frame_probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)first_frame_probe, context, NULL);
+  gst_object_unref(pad);
   printf("%s", "Returning successfully...\n");
   return 0;
 }
@@ -184,9 +337,10 @@ int start(GstContext *context) {
   g_signal_connect(bus, "message", G_CALLBACK(cb_message), context);
   g_main_loop_run(context->loop);
   g_main_loop_unref(context->loop);
+  gst_bus_remove_signal_watch(bus);
+  g_signal_handlers_disconnect_by_func(bus, cb_message, context);
   gst_object_unref(bus);
-  gst_element_set_state(context->pipeline, GST_STATE_NULL);
-  gst_object_unref(context->pipeline);
+  release(context);
   free(context);
   return 0;
 }